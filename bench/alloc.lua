@@ -0,0 +1,31 @@
+-- allocation-heavy code; bench.pwn runs it with and without a memory limit to compare the allocators
+local util = require "bench.util"
+
+local N = 1000000
+
+util.time("small tables", N, function(n)
+  for i = 1, n do
+    local t = {i, i + 1, x = i}
+  end
+end)
+
+util.time("strings", N, function(n)
+  for i = 1, n do
+    local s = "item" .. i
+  end
+end)
+
+util.time("closures", N, function(n)
+  for i = 1, n do
+    local f = function() return i end
+  end
+end)
+
+util.time("growing arrays", N // 1000, function(n)
+  for _ = 1, n do
+    local t = {}
+    for i = 1, 1000 do
+      t[i] = i
+    end
+  end
+end)
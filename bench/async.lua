@@ -0,0 +1,37 @@
+-- runs a command handler written as an async function many times, with and without the thread pool
+local util = require "bench.util"
+
+local N = 100000
+
+local function handler(playerid, cmdtext)
+  local args = {}
+  for word in cmdtext:gmatch("%S+") do
+    args[#args + 1] = word
+  end
+  return #args > 0 and playerid
+end
+
+local function spam(n)
+  for i = 1, n do
+    async(handler, i % 1000, "/givecash 12 5000")
+  end
+end
+
+local function run(name, limit)
+  asyncpool(limit)
+  local elapsed = util.time(name, N, spam)
+  local _, created0, reused0, saved0 = asyncpool()
+  collectgarbage("stop")
+  local before = collectgarbage("count")
+  spam(N)
+  local allocated = collectgarbage("count") - before
+  collectgarbage("restart")
+  local _, created, reused, saved = asyncpool()
+  print(string.format("  allocated %.0f KiB per %d calls, threads created %d, reused %d, saved %d bytes",
+    allocated, N, created - created0, reused - reused0, saved - saved0))
+  return elapsed
+end
+
+local unpooled = run("async without pool", 0)
+local pooled = run("async with pool", 32)
+util.compare("pooled vs unpooled", unpooled, pooled)
@@ -0,0 +1,39 @@
+-- calls natives that resolve their arguments with amx_GetAddr, with and without Lua-backed addresses
+local interop = require "interop"
+local util = require "bench.util"
+
+local N = 200000
+local INVALID_PLAYER_ID = 0xFFFF
+
+local GetPlayerName = interop.getnative("GetPlayerName")
+
+local heap = util.time("GetPlayerName table (AMX heap)", N, function(n)
+  local name = {}
+  for i = 1, 24 do name[i] = 0 end
+  for _ = 1, n do
+    GetPlayerName(INVALID_PLAYER_ID, name, 24)
+  end
+end)
+local buffer = util.time("GetPlayerName buffer (Lua-backed)", N, function(n)
+  local name = interop.newbuffer(24)
+  for _ = 1, n do
+    GetPlayerName(INVALID_PLAYER_ID, name, 24)
+  end
+end)
+util.compare("buffer vs table", heap, buffer)
+
+local strmid = interop.getnative("strmid")
+heap = util.time("strmid table (AMX heap)", N, function(n)
+  local out = {}
+  for i = 1, 32 do out[i] = 0 end
+  for _ = 1, n do
+    strmid(out, "benchmark string", 0, 16, 32)
+  end
+end)
+buffer = util.time("strmid buffer (Lua-backed)", N, function(n)
+  local out = interop.newbuffer(32)
+  for _ = 1, n do
+    strmid(out, "benchmark string", 0, 16, 32)
+  end
+end)
+util.compare("buffer vs table", heap, buffer)
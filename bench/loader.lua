@@ -0,0 +1,35 @@
+-- compiles a generated script from one string and from a reader returning small pieces,
+-- the Lua-side counterpart of the lua_loader/lua_write benchmark in bench.pwn
+local util = require "bench.util"
+
+local N = 200
+local LINES = 2000
+local PIECE = 16
+
+local lines = {}
+for i = 1, LINES do
+  lines[i] = string.format("v%d = %d + %d\n", i % 150, i, i * 2)
+end
+local code = table.concat(lines)
+
+local pieces = {}
+for i = 1, #code, PIECE do
+  pieces[#pieces + 1] = code:sub(i, i + PIECE - 1)
+end
+print(string.format("  %d bytes in %d pieces of %d bytes", #code, #pieces, PIECE))
+
+local whole = util.time("load, one string", N, function(n)
+  for _ = 1, n do
+    assert(load(code, "=bench"))
+  end
+end)
+local chunked = util.time("load, reader of small pieces", N, function(n)
+  for _ = 1, n do
+    local i = 0
+    assert(load(function()
+      i = i + 1
+      return pieces[i]
+    end, "=bench"))
+  end
+end)
+util.compare("pieces vs one string", whole, chunked)
@@ -0,0 +1,43 @@
+-- calls the same natives through the generic, fast and signature paths of interop.getnative
+local interop = require "interop"
+local util = require "bench.util"
+
+local N = 200000
+local INVALID_PLAYER_ID = 0xFFFF
+
+local function setpos(n, f)
+  for _ = 1, n do
+    f(INVALID_PLAYER_ID, 1.0, 2.0, 3.0)
+  end
+end
+
+local generic = util.time("SetPlayerPos generic", N, setpos, interop.getnative("SetPlayerPos"))
+local fast = util.time("SetPlayerPos fast", N, setpos, interop.getnative("SetPlayerPos", true))
+local sig = util.time("SetPlayerPos \"ifff:b\"", N, setpos, interop.getnative("SetPlayerPos", "ifff:b"))
+util.compare("signature vs generic", generic, sig)
+util.compare("signature vs fast", fast, sig)
+
+local GetPlayerPos = interop.getnative("GetPlayerPos")
+generic = util.time("GetPlayerPos generic (tables)", N, function(n)
+  local x, y, z = {0.0}, {0.0}, {0.0}
+  for _ = 1, n do
+    GetPlayerPos(INVALID_PLAYER_ID, x, y, z)
+  end
+end)
+local GetPlayerPosSig = interop.getnative("GetPlayerPos", "iFFF:b")
+sig = util.time("GetPlayerPos \"iFFF:b\"", N, function(n)
+  for _ = 1, n do
+    local ok, x, y, z = GetPlayerPosSig(INVALID_PLAYER_ID)
+  end
+end)
+util.compare("signature vs generic", generic, sig)
+
+local function message(n, f)
+  for _ = 1, n do
+    f(INVALID_PLAYER_ID, -1, "benchmark message")
+  end
+end
+
+generic = util.time("SendClientMessage generic", N, message, interop.getnative("SendClientMessage"))
+sig = util.time("SendClientMessage \"iis:b\"", N, message, interop.getnative("SendClientMessage", "iis:b"))
+util.compare("signature vs generic", generic, sig)
@@ -0,0 +1,46 @@
+-- reads a player stats table owned by another state through a proxy and through remote.copy;
+-- bench.pwn registers the table in a second state and sets stats_ref, otherwise it is registered here
+-- and no proxy is involved
+local remote = require "remote"
+local util = require "bench.util"
+
+local N = 20000
+
+local ref = stats_ref
+if not ref then
+  print("  stats_ref is not set, the table is registered in this state")
+  ref = require "bench.remote_source"
+end
+local stats = remote.get(ref)
+local isproxy = remote.isproxy(stats)
+
+local function read(s)
+  local total = s.score + s.money + s.kills + s.deaths + s.level + #s.name
+  local pos = s.pos
+  total = total + pos.x + pos.y + pos.z
+  local weapons = s.weapons
+  for i = 1, 13 do
+    total = total + weapons[i].ammo
+  end
+  return total
+end
+
+local proxy = util.time(isproxy and "proxy field access" or "local field access", N, function(n)
+  for _ = 1, n do
+    read(stats)
+  end
+end)
+if not isproxy then
+  return
+end
+util.time("remote.copy", N, function(n)
+  for _ = 1, n do
+    remote.copy(stats)
+  end
+end)
+local copy = util.time("remote.copy and field access", N, function(n)
+  for _ = 1, n do
+    read(remote.copy(stats))
+  end
+end)
+util.compare("copy vs proxy", proxy, copy)
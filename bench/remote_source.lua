@@ -0,0 +1,21 @@
+-- registers a player stats table for remote_copy.lua and stores its reference in stats_ref
+local remote = require "remote"
+
+local weapons = {}
+for i = 1, 13 do
+  weapons[i] = {id = 21 + i, ammo = i * 50}
+end
+
+local stats = {
+  name = "Benchmark_Player",
+  score = 1500,
+  money = 250000,
+  kills = 320,
+  deaths = 140,
+  level = 27,
+  pos = {x = 1958.33, y = 1343.12, z = 15.36},
+  weapons = weapons,
+}
+
+stats_ref = remote.register(stats)
+return stats_ref
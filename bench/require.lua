@@ -0,0 +1,64 @@
+-- requires generated modules through the shared compiled-chunk cache and compares with loadfile,
+-- which always parses; reloading a module stands in for another state requiring it
+local util = require "bench.util"
+
+local MODULES = 20
+local FUNCS = 200
+local ROUNDS = 20
+
+local dir = package.searchpath("bench.util", package.path):match("^(.*[/\\])")
+
+local lines = {"local M = {}\n"}
+for i = 1, FUNCS do
+  lines[#lines + 1] = string.format("function M.f%d(a, b)\n  local t = {a, b, %d}\n  for i = 1, #t do a = a + t[i] * %d end\n  return a, tostring(b) .. %q\nend\n", i, i, i, "f" .. i)
+end
+lines[#lines + 1] = "return M\n"
+local code = table.concat(lines)
+
+local names, paths = {}, {}
+for i = 1, MODULES do
+  names[i] = "bench.generated" .. i
+  paths[i] = dir .. "generated" .. i .. ".lua"
+  local file = assert(io.open(paths[i], "w"))
+  file:write(code)
+  file:close()
+end
+print(string.format("  %d modules of %d bytes", MODULES, #code))
+
+local function stats(name, hits0, misses0)
+  local hits, misses, entries = package.cachestats()
+  print(string.format("  %s: cache hits %d, misses %d, entries %d", name, hits - hits0, misses - misses0, entries))
+end
+
+local parsed = util.time("loadfile", MODULES * ROUNDS, function(n)
+  for r = 1, n // MODULES do
+    for i = 1, MODULES do
+      assert(loadfile(paths[i]))()
+    end
+  end
+end)
+
+local hits0, misses0 = package.cachestats()
+util.time("require, first load", MODULES, function(n)
+  for i = 1, n do
+    require(names[i])
+  end
+end)
+stats("first load", hits0, misses0)
+
+hits0, misses0 = package.cachestats()
+local cached = util.time("require, reloaded", MODULES * ROUNDS, function(n)
+  for r = 1, n // MODULES do
+    for i = 1, MODULES do
+      package.loaded[names[i]] = nil
+      require(names[i])
+    end
+  end
+end)
+stats("reloaded", hits0, misses0)
+util.compare("cached require vs loadfile", parsed, cached)
+
+for i = 1, MODULES do
+  package.loaded[names[i]] = nil
+  os.remove(paths[i])
+end
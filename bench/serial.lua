@@ -0,0 +1,194 @@
+-- encodes and decodes a player save with serial and with a pure-Lua JSON encoder and decoder
+local serial = require "serial"
+local util = require "bench.util"
+
+local N = 2000
+
+local json = {}
+
+local escapes = {['"'] = '\\"', ['\\'] = '\\\\', ['\b'] = '\\b', ['\f'] = '\\f', ['\n'] = '\\n', ['\r'] = '\\r', ['\t'] = '\\t'}
+
+local function encodevalue(v, out)
+  local t = type(v)
+  if t == "table" then
+    if #v > 0 or next(v) == nil then
+      out[#out + 1] = "["
+      for i = 1, #v do
+        if i > 1 then out[#out + 1] = "," end
+        encodevalue(v[i], out)
+      end
+      out[#out + 1] = "]"
+    else
+      out[#out + 1] = "{"
+      local first = true
+      for k, e in pairs(v) do
+        if not first then out[#out + 1] = "," end
+        first = false
+        encodevalue(tostring(k), out)
+        out[#out + 1] = ":"
+        encodevalue(e, out)
+      end
+      out[#out + 1] = "}"
+    end
+  elseif t == "string" then
+    out[#out + 1] = '"' .. v:gsub('[%c"\\]', function(c)
+      return escapes[c] or string.format("\\u%04x", c:byte())
+    end) .. '"'
+  elseif t == "number" then
+    out[#out + 1] = math.type(v) == "integer" and tostring(v) or string.format("%.17g", v)
+  elseif t == "boolean" then
+    out[#out + 1] = tostring(v)
+  else
+    out[#out + 1] = "null"
+  end
+end
+
+function json.encode(v)
+  local out = {}
+  encodevalue(v, out)
+  return table.concat(out)
+end
+
+local decodevalue
+
+local function skip(s, i)
+  return s:find("[^ \t\r\n]", i) or #s + 1
+end
+
+local unescapes = {['"'] = '"', ['\\'] = '\\', ['/'] = '/', b = '\b', f = '\f', n = '\n', r = '\r', t = '\t'}
+
+local function decodestring(s, i)
+  local parts = {}
+  local j = i + 1
+  while true do
+    local k = s:find('["\\]', j)
+    parts[#parts + 1] = s:sub(j, k - 1)
+    if s:sub(k, k) == '"' then
+      return table.concat(parts), k + 1
+    end
+    local c = s:sub(k + 1, k + 1)
+    if c == "u" then
+      parts[#parts + 1] = utf8.char(tonumber(s:sub(k + 2, k + 5), 16))
+      j = k + 6
+    else
+      parts[#parts + 1] = unescapes[c]
+      j = k + 2
+    end
+  end
+end
+
+function decodevalue(s, i)
+  i = skip(s, i)
+  local c = s:sub(i, i)
+  if c == "{" then
+    local t = {}
+    i = skip(s, i + 1)
+    if s:sub(i, i) == "}" then return t, i + 1 end
+    while true do
+      local k
+      k, i = decodestring(s, skip(s, i))
+      i = skip(s, i) + 1
+      t[k], i = decodevalue(s, i)
+      i = skip(s, i)
+      c = s:sub(i, i)
+      i = i + 1
+      if c == "}" then return t, i end
+    end
+  elseif c == "[" then
+    local t = {}
+    i = skip(s, i + 1)
+    if s:sub(i, i) == "]" then return t, i + 1 end
+    while true do
+      t[#t + 1], i = decodevalue(s, i)
+      i = skip(s, i)
+      c = s:sub(i, i)
+      i = i + 1
+      if c == "]" then return t, i end
+    end
+  elseif c == '"' then
+    return decodestring(s, i)
+  elseif s:sub(i, i + 3) == "true" then
+    return true, i + 4
+  elseif s:sub(i, i + 4) == "false" then
+    return false, i + 5
+  elseif s:sub(i, i + 3) == "null" then
+    return nil, i + 4
+  end
+  local num = s:match("^-?%d+%.?%d*[eE]?[-+]?%d*", i)
+  return math.tointeger(tonumber(num)) or tonumber(num), i + #num
+end
+
+function json.decode(s)
+  return (decodevalue(s, 1))
+end
+
+local inventory = {}
+for i = 1, 40 do
+  inventory[i] = {item = i * 3, amount = i % 7 + 1, durability = 0.5 + i / 100, name = "item_" .. i}
+end
+local achievements = {}
+for i = 1, 25 do
+  achievements[i] = "achievement_" .. i
+end
+
+local save = {
+  name = "Benchmark_Player",
+  password = "5e884898da28047151d0e56f8dc6292773603d0d6aabbdd62a11ef721d1542d8",
+  admin = 0,
+  vip = true,
+  score = 1500,
+  money = 250000,
+  bank = 1250000,
+  kills = 320,
+  deaths = 140,
+  skin = 294,
+  health = 100.0,
+  armour = 57.5,
+  pos = {x = 1958.3783, y = 1343.1572, z = 15.3746, angle = 269.1425, interior = 0, world = 0},
+  weapons = {{24, 120}, {25, 40}, {31, 500}, {34, 25}},
+  inventory = inventory,
+  achievements = achievements,
+  settings = {hud = true, chat = true, language = "en", volume = 0.8},
+  lastlogin = 1760659200,
+}
+
+local encoded = serial.encode(save)
+local text = json.encode(save)
+print(string.format("  serial %d bytes, JSON %d bytes", #encoded, #text))
+assert(serial.decode(encoded).inventory[40].name == "item_40")
+assert(json.decode(text).inventory[40].name == "item_40")
+
+local jenc = util.time("json.encode", N, function(n)
+  for _ = 1, n do
+    json.encode(save)
+  end
+end)
+local senc = util.time("serial.encode", N, function(n)
+  for _ = 1, n do
+    serial.encode(save)
+  end
+end)
+util.compare("serial vs JSON encode", jenc, senc)
+
+local ok, interop = pcall(require, "interop")
+if ok then
+  local buf = interop.newbuffer((serial.size(save) + 3) // 4)
+  local bufenc = util.time("serial.encode to buffer", N, function(n)
+    for _ = 1, n do
+      serial.encode(save, buf)
+    end
+  end)
+  util.compare("buffer vs JSON encode", jenc, bufenc)
+end
+
+local jdec = util.time("json.decode", N, function(n)
+  for _ = 1, n do
+    json.decode(text)
+  end
+end)
+local sdec = util.time("serial.decode", N, function(n)
+  for _ = 1, n do
+    serial.decode(encoded)
+  end
+end)
+util.compare("serial vs JSON decode", jdec, sdec)
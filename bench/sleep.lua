@@ -0,0 +1,33 @@
+-- raises the AMX sleep status from interop.sleep and compares it with raising an error table
+local interop = require "interop"
+local util = require "bench.util"
+
+local N = 100000
+
+local function cont() end
+
+-- a status caught by pcall is not released until the next public returns,
+-- so this measures the allocating path; a handled sleep reuses the status
+local status = util.time("pcall(interop.sleep)", N, function(n)
+  local sleep = interop.sleep
+  for _ = 1, n do
+    pcall(sleep, cont, 1)
+  end
+end)
+
+local errormt = {__tostring = function(self) return self.__where .. "AMX error " .. self.__amxerr end}
+local tbl = util.time("pcall(error, error table)", N, function(n)
+  for _ = 1, n do
+    pcall(function()
+      error(setmetatable({__amxerr = 12, __retval = 1, __cont = cont, __where = string.format("%s:%d: ", "sleep.lua", 24)}, errormt))
+    end)
+  end
+end)
+util.compare("sleep status vs error table", tbl, status)
+
+local str = util.time("pcall(error, string)", N, function(n)
+  for _ = 1, n do
+    pcall(error, "sleep")
+  end
+end)
+util.compare("sleep status vs string", str, status)
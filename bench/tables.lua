@@ -0,0 +1,36 @@
+-- table and closure churn over many GC cycles; bench.pwn runs it with and without the pooled allocator
+local util = require "bench.util"
+
+local N = 100000
+
+local function newplayer(id)
+  local p = {id = id, name = "player" .. id, pos = {x = 0.0, y = 0.0, z = 0.0}, items = {}}
+  function p.move(x, y, z)
+    p.pos.x, p.pos.y, p.pos.z = x, y, z
+  end
+  for i = 1, 8 do
+    p.items[i] = {kind = i, count = id % 10}
+  end
+  return p
+end
+
+util.time("player objects", N, function(n)
+  for i = 1, n do
+    newplayer(i).move(1.0, 2.0, 3.0)
+  end
+end)
+
+-- a live set keeps part of the objects between collections, like connected players
+util.time("player objects with live set", N, function(n)
+  local live = {}
+  for i = 1, n do
+    live[i % 500] = newplayer(i)
+  end
+end)
+
+util.time("method closures", N * 5, function(n)
+  local t = {}
+  for i = 1, n do
+    t[i % 64] = function(a) return a + i end
+  end
+end)
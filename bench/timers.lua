@@ -0,0 +1,59 @@
+-- schedules and cancels many timers; the timers never fire while the script runs
+local timer = require "timer"
+local util = require "bench.util"
+
+local N = 100000
+
+local function noop() end
+
+local timers = {}
+
+util.time("timer.ms same interval", N, function(n)
+  for i = 1, n do
+    timers[i] = timer.ms(noop, 60000)
+  end
+end)
+util.time("cancel in schedule order", N, function(n)
+  for i = 1, n do
+    timers[i]:cancel()
+  end
+end)
+
+util.time("timer.ms mixed intervals", N, function(n)
+  for i = 1, n do
+    timers[i] = timer.ms(noop, 60000 + (i * 7919) % 100000)
+  end
+end)
+util.time("cancel in reverse order", N, function(n)
+  for i = n, 1, -1 do
+    timers[i]:cancel()
+  end
+end)
+
+util.time("timer.tick mixed intervals", N, function(n)
+  for i = 1, n do
+    timers[i] = timer.tick(noop, 1000 + (i * 7919) % 10000)
+  end
+end)
+util.time("reschedule", N, function(n)
+  for i = 1, n do
+    timers[i]:reschedule(2000 + (i * 104729) % 10000)
+  end
+end)
+util.time("cancel in reverse order", N, function(n)
+  for i = n, 1, -1 do
+    timers[i]:cancel()
+  end
+end)
+timers = nil
+
+if async then
+  local M = N // 10
+  util.time("async timer.wait", M, function(n)
+    for i = 1, n do
+      async(function()
+        timer.wait(60000 + i % 1000)
+      end)
+    end
+  end)
+end
@@ -0,0 +1,20 @@
+-- timing helpers shared by the benchmark scripts
+local util = {}
+
+-- runs f(n) once and prints the time per iteration
+function util.time(name, n, f, ...)
+  collectgarbage()
+  collectgarbage()
+  local start = os.clock()
+  f(n, ...)
+  local elapsed = os.clock() - start
+  print(string.format("%-40s %9d x %10.3f ms %10.1f ns/op", name, n, elapsed * 1000, elapsed * 1e9 / n))
+  return elapsed
+end
+
+-- prints the ratio of two times measured by util.time
+function util.compare(name, base, other)
+  print(string.format("%-40s %10.2fx", name, base / other))
+end
+
+return util
@@ -0,0 +1,57 @@
+-- round trips through the continuation helpers: interop.vacall, timer.timeout and coroutine.resumehooked
+local timer = require "timer"
+local util = require "bench.util"
+
+local N = 200000
+
+local function id(...) return ... end
+
+local ok, interop = pcall(require, "interop")
+if ok then
+  local f = interop.vacall(id)
+  util.time("interop.vacall, no results", N, function(n)
+    for i = 1, n do
+      f(i, 1.5, true)
+    end
+  end)
+  util.time("interop.vacall, restored results", N, function(n)
+    for i = 1, n do
+      local a, b, c = f(i, 1.5, true)
+    end
+  end)
+else
+  print("interop is not available, skipping interop.vacall")
+end
+
+local direct = util.time("pcall", N, function(n)
+  for i = 1, n do
+    pcall(id, i)
+  end
+end)
+local timeout = util.time("timer.timeout", N, function(n)
+  local timeout = timer.timeout
+  for i = 1, n do
+    timeout(1000, id, i)
+  end
+end)
+util.compare("timer.timeout vs pcall", direct, timeout)
+
+local function worker()
+  local v = 0
+  while true do
+    v = coroutine.yield(v + 1)
+  end
+end
+local resume = util.time("coroutine.resume", N, function(n)
+  local co = coroutine.create(worker)
+  for i = 1, n do
+    coroutine.resume(co, i)
+  end
+end)
+local hooked = util.time("coroutine.resumehooked", N, function(n)
+  local co = coroutine.create(worker)
+  for i = 1, n do
+    coroutine.resumehooked(co, i)
+  end
+end)
+util.compare("resumehooked vs resume", resume, hooked)
@@ -1,6 +1,8 @@
 #include "loader.h"
 #include "sdk/plugincommon.h"
 
+#include <cstring>
+
 extern void **ppData;
 
 AMX *last_amx;
@@ -48,21 +50,58 @@ struct AMX_FAKE_HEADER : public AMX_HEADER
 	uint16_t namelength;
 };
 
-AMX *amx::LoadNew(const char *name, int32_t heapspace, uint16_t namelength, std::function<void(AMX*, void*)> &&init)
+static AMX_FAKE_HEADER MakeHeader(int32_t dataspace, int32_t heapspace, uint16_t namelength)
 {
 	AMX_FAKE_HEADER hdr{};
 	hdr.magic = AMX_MAGIC;
 	hdr.file_version = 7;
 	hdr.amx_version = MIN_AMX_VERSION;
-	hdr.cod = hdr.dat = hdr.hea = hdr.size = sizeof(hdr);
+	hdr.cod = hdr.dat = sizeof(hdr);
+	hdr.hea = hdr.size = hdr.dat + dataspace;
 	hdr.stp = hdr.hea + heapspace;
 	hdr.defsize = sizeof(AMX_FUNCSTUBNT);
 	hdr.nametable = reinterpret_cast<unsigned char*>(&hdr.namelength) - reinterpret_cast<unsigned char*>(&hdr);
 	hdr.namelength = namelength;
 	hdr.publics = hdr.natives = hdr.libraries = hdr.pubvars = hdr.tags = hdr.nametable;
+	return hdr;
+}
+
+AMX *amx::LoadNew(const char *name, int32_t heapspace, uint16_t namelength, std::function<void(AMX*, void*)> &&init)
+{
+	AMX_FAKE_HEADER hdr = MakeHeader(0, heapspace, namelength);
 	return LoadProgram(name, reinterpret_cast<char*>(&hdr), std::move(init));
 }
 
+AMX *amx::LoadPrivate(int32_t dataspace, int32_t heapspace, uint16_t namelength, std::function<void(AMX*, void*)> &&init)
+{
+	// initialized like a filterscript, but never registered in the server
+	AMX_FAKE_HEADER hdr = MakeHeader(dataspace, heapspace, namelength);
+	auto program = new unsigned char[hdr.stp]();
+	std::memcpy(program, &hdr, sizeof(hdr));
+	auto amx = new AMX();
+
+	last_amx = nullptr;
+	init_func = std::move(init);
+	int error = amx_Init(amx, program);
+	last_amx = nullptr;
+	init_func = nullptr;
+	if(error != AMX_ERR_NONE)
+	{
+		delete amx;
+		delete[] program;
+		return nullptr;
+	}
+	return amx;
+}
+
+void amx::UnloadPrivate(AMX *amx)
+{
+	auto program = amx->base;
+	amx_Cleanup(amx);
+	delete amx;
+	delete[] program;
+}
+
 bool amx::Unload(const char *name)
 {
 	return UnloadFilterScript(name);
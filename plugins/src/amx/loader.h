@@ -13,6 +13,8 @@ namespace amx
 	AMX *LoadProgram(const char *name, const char *program, std::function<void(AMX*, void*)> &&init);
 	AMX *LoadNew(const char *name, int32_t heapspace, uint16_t namelength, std::function<void(AMX*, void*)> &&init);
 	bool Unload(const char *name);
+	AMX *LoadPrivate(int32_t dataspace, int32_t heapspace, uint16_t namelength, std::function<void(AMX*, void*)> &&init);
+	void UnloadPrivate(AMX *amx);
 }
 
 #endif
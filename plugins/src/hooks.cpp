@@ -6,6 +6,7 @@
 #include "lua/interop/public.h"
 #include "lua/interop/pubvar.h"
 #include "lua/interop/tags.h"
+#include "lua/interop/router.h"
 #include "amx/loader.h"
 #include "amx/fileutils.h"
 
@@ -111,7 +112,7 @@ namespace hooks
 	int AMX_HOOK_FUNC(amx_Exec, AMX *amx, cell *retval, int index)
 	{
 		int result;
-		if(lua::interop::amx_exec(amx, retval, index, result))
+		if(lua::interop::amx_exec(amx, retval, index, result) || lua::interop::router_exec(amx, retval, index, result))
 		{
 			return result;
 		}
@@ -134,7 +135,7 @@ namespace hooks
 	int AMX_HOOK_FUNC(amx_FindPublic, AMX *amx, const char *funcname, int *index)
 	{
 		int error;
-		if(lua::interop::amx_find_public(amx, funcname, index, error))
+		if(lua::interop::amx_find_public(amx, funcname, index, error) || lua::interop::router_find_public(amx, funcname, index, error))
 		{
 			return error;
 		}
@@ -144,7 +145,7 @@ namespace hooks
 
 	int AMX_HOOK_FUNC(amx_GetPublic, AMX *amx, int index, char *funcname)
 	{
-		if(lua::interop::amx_get_public(amx, index, funcname))
+		if(lua::interop::amx_get_public(amx, index, funcname) || lua::interop::router_get_public(amx, index, funcname))
 		{
 			return AMX_ERR_NONE;
 		}
@@ -154,7 +155,7 @@ namespace hooks
 
 	int AMX_HOOK_FUNC(amx_NumPublics, AMX *amx, int *number)
 	{
-		if(lua::interop::amx_num_publics(amx, number))
+		if(lua::interop::amx_num_publics(amx, number) || lua::interop::router_num_publics(amx, number))
 		{
 			return AMX_ERR_NONE;
 		}
@@ -0,0 +1,575 @@
+#include "compiler.h"
+#include "lua_utils.h"
+#include "lua_api.h"
+
+#include <string>
+#include <memory>
+#include <queue>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+
+struct chunk_entry
+{
+	// the hash of the code, checked on every hit
+	uint64_t hash;
+	std::shared_ptr<const std::string> bytecode;
+	// the code of string chunks, compared on every hit since the key only has its hash
+	std::shared_ptr<const std::string> source;
+	std::list<std::string>::iterator lru;
+	size_t bytes;
+};
+
+struct chunk_header
+{
+	char magic[4];
+	uint32_t keylen;
+	uint64_t hash;
+};
+
+// compiled chunks are shared by all states, keyed by the file name or the hash of the code
+static std::mutex cache_mutex;
+static std::unordered_map<std::string, chunk_entry> chunk_cache;
+static std::list<std::string> cache_lru;
+static size_t cache_bytes = 0;
+static std::string cache_dir;
+
+// the least recently used chunks are evicted above these limits
+static const size_t cache_maxentries = 1024;
+static const size_t cache_maxbytes = 32 * 1024 * 1024;
+static size_t cache_hits = 0;
+static size_t cache_misses = 0;
+
+static uint64_t fnv1a(const char *data, size_t len, uint64_t hash = 14695981039346656037ULL)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static std::string hexstring(uint64_t value)
+{
+	char buf[17];
+	std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value);
+	return buf;
+}
+
+static bool readfile(const char *filename, std::string &data)
+{
+	FILE *f = std::fopen(filename, "rb");
+	if(!f)
+	{
+		return false;
+	}
+	char buf[BUFSIZ];
+	size_t len;
+	while((len = std::fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		data.append(buf, len);
+	}
+	bool ok = !std::ferror(f);
+	std::fclose(f);
+	return ok;
+}
+
+static int dumpwriter(lua_State*, const void *p, size_t sz, void *ud)
+{
+	reinterpret_cast<std::string*>(ud)->append(reinterpret_cast<const char*>(p), sz);
+	return 0;
+}
+
+static std::string diskpath(const std::string &dir, const std::string &key)
+{
+	return dir + LUA_DIRSEP + hexstring(fnv1a(key.data(), key.size())) + ".luac";
+}
+
+static std::shared_ptr<const std::string> diskload(const std::string &dir, const std::string &key, uint64_t hash)
+{
+	std::string data;
+	if(!readfile(diskpath(dir, key).c_str(), data) || data.size() < sizeof(chunk_header))
+	{
+		return nullptr;
+	}
+	chunk_header header;
+	std::memcpy(&header, data.data(), sizeof(header));
+	if(std::memcmp(header.magic, "YALH", 4) != 0 || header.hash != hash || header.keylen != key.size())
+	{
+		return nullptr;
+	}
+	if(data.size() < sizeof(header) + key.size() || data.compare(sizeof(header), key.size(), key) != 0)
+	{
+		return nullptr;
+	}
+	return std::make_shared<const std::string>(data, sizeof(header) + key.size());
+}
+
+// written to a temporary file first, so a partially written file is never loaded
+static void diskstore(const std::string &dir, const std::string &key, uint64_t hash, const std::string &bytecode)
+{
+	std::string path = diskpath(dir, key);
+	std::string temp = path + "." + hexstring(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	FILE *f = std::fopen(temp.c_str(), "wb");
+	if(!f)
+	{
+		return;
+	}
+	chunk_header header;
+	std::memcpy(header.magic, "YALH", 4);
+	header.keylen = (uint32_t)key.size();
+	header.hash = hash;
+	bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && std::fwrite(key.data(), 1, key.size(), f) == key.size();
+	ok = ok && std::fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+	ok = std::fclose(f) == 0 && ok;
+	if(ok && std::rename(temp.c_str(), path.c_str()) != 0)
+	{
+		// an existing file is not replaced on Windows
+		std::remove(path.c_str());
+		ok = std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+	if(!ok)
+	{
+		std::remove(temp.c_str());
+	}
+}
+
+static void cache_erase(std::unordered_map<std::string, chunk_entry>::iterator it)
+{
+	cache_bytes -= it->second.bytes;
+	cache_lru.erase(it->second.lru);
+	chunk_cache.erase(it);
+}
+
+static void cache_insert(const std::string &key, chunk_entry &&entry)
+{
+	auto it = chunk_cache.find(key);
+	if(it != chunk_cache.end())
+	{
+		cache_erase(it);
+	}
+	entry.bytes = key.size() + entry.bytecode->size() + (entry.source ? entry.source->size() : 0);
+	cache_lru.push_front(key);
+	entry.lru = cache_lru.begin();
+	cache_bytes += entry.bytes;
+	chunk_cache.emplace(key, std::move(entry));
+	while(chunk_cache.size() > 1 && (chunk_cache.size() > cache_maxentries || cache_bytes > cache_maxbytes))
+	{
+		cache_erase(chunk_cache.find(cache_lru.back()));
+	}
+}
+
+static std::shared_ptr<const std::string> cache_find(const std::string &key, uint64_t hash, const std::string *source)
+{
+	std::string dir;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		auto it = chunk_cache.find(key);
+		if(it != chunk_cache.end() && it->second.hash == hash && (!source || (it->second.source && *it->second.source == *source)))
+		{
+			cache_hits++;
+			cache_lru.splice(cache_lru.begin(), cache_lru, it->second.lru);
+			return it->second.bytecode;
+		}
+		dir = cache_dir;
+	}
+	if(!dir.empty() && !source)
+	{
+		if(auto bytecode = diskload(dir, key, hash))
+		{
+			std::lock_guard<std::mutex> lock(cache_mutex);
+			cache_hits++;
+			cache_insert(key, chunk_entry{hash, bytecode, nullptr, cache_lru.end(), 0});
+			return bytecode;
+		}
+	}
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	cache_misses++;
+	return nullptr;
+}
+
+// string chunks are kept only in memory, the disk cache is for files
+static void cache_store(const std::string &key, uint64_t hash, std::string &&bytecode, const std::string *source)
+{
+	auto ptr = std::make_shared<const std::string>(std::move(bytecode));
+	std::string dir;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		cache_insert(key, chunk_entry{hash, ptr, source ? std::make_shared<const std::string>(*source) : nullptr, cache_lru.end(), 0});
+		dir = cache_dir;
+	}
+	if(!dir.empty() && !source)
+	{
+		diskstore(dir, key, hash, *ptr);
+	}
+}
+
+static bool textmode(const char *mode)
+{
+	return !mode || std::strchr(mode, 't');
+}
+
+// loads the code, going through the cache if it is a text chunk
+static int loadcached(lua_State *L, const std::string &key, uint64_t hash, const std::string &code, const char *chunkname, const char *mode, bool isfile)
+{
+	if(code.empty() || code[0] == LUA_SIGNATURE[0] || !textmode(mode))
+	{
+		return luaL_loadbufferx(L, code.data(), code.size(), chunkname, mode);
+	}
+	int status = luaL_loadbufferx(L, code.data(), code.size(), chunkname, mode);
+	if(status == LUA_OK)
+	{
+		std::string bytecode;
+		if(lua_dump(L, dumpwriter, &bytecode, 0) == 0)
+		{
+			cache_store(key, hash, std::move(bytecode), isfile ? nullptr : &code);
+		}
+	}
+	return status;
+}
+
+static bool loadhit(lua_State *L, const std::shared_ptr<const std::string> &bytecode, const char *chunkname)
+{
+	if(luaL_loadbufferx(L, bytecode->data(), bytecode->size(), chunkname, "b") == LUA_OK)
+	{
+		return true;
+	}
+	// produced by a different build, compiled again
+	lua_pop(L, 1);
+	return false;
+}
+
+int lua::compiler::loadfile(lua_State *L, const char *filename, const char *mode)
+{
+	std::string code;
+	if(!textmode(mode) || !readfile(filename, code))
+	{
+		return luaL_loadfilex(L, filename, mode);
+	}
+	std::string key = filename;
+	std::string chunkname = "@" + key;
+	if(code.compare(0, 3, "\xEF\xBB\xBF") == 0)
+	{
+		code.erase(0, 3);
+	}
+	if(!code.empty() && code[0] == '#')
+	{
+		// the line is kept to preserve line numbers
+		code.erase(0, code.find('\n') == std::string::npos ? code.size() : code.find('\n'));
+		if(code.size() > 1 && code[1] == LUA_SIGNATURE[0])
+		{
+			code.erase(0, 1);
+		}
+	}
+	if(!code.empty() && code[0] == LUA_SIGNATURE[0])
+	{
+		return luaL_loadbufferx(L, code.data(), code.size(), chunkname.c_str(), mode);
+	}
+	// the cached chunk is used only for the same code, so edits are never missed
+	uint64_t hash = fnv1a(code.data(), code.size());
+	if(auto bytecode = cache_find(key, hash, nullptr))
+	{
+		if(loadhit(L, bytecode, chunkname.c_str()))
+		{
+			return LUA_OK;
+		}
+	}
+	return loadcached(L, key, hash, code, chunkname.c_str(), mode, true);
+}
+
+int lua::compiler::loadstring(lua_State *L, const std::string &code, const char *chunkname, const char *mode)
+{
+	if(!textmode(mode))
+	{
+		return luaL_loadbufferx(L, code.data(), code.size(), chunkname, mode);
+	}
+	uint64_t hash = fnv1a(code.data(), code.size());
+	std::string key = std::string("=") + hexstring(hash) + ":" + chunkname;
+	if(auto bytecode = cache_find(key, hash, &code))
+	{
+		if(loadhit(L, bytecode, chunkname))
+		{
+			return LUA_OK;
+		}
+	}
+	return loadcached(L, key, hash, code, chunkname, mode, false);
+}
+
+void lua::compiler::setcachedir(const char *dir)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	cache_dir = dir ? dir : "";
+}
+
+void lua::compiler::getcachestats(size_t &hits, size_t &misses, size_t &entries)
+{
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	hits = cache_hits;
+	misses = cache_misses;
+	entries = chunk_cache.size();
+}
+
+struct compile_job
+{
+	lua_State *L;
+	std::weak_ptr<char> lifetime;
+	int ref;
+	std::string filename;
+	std::string mode;
+	bool hasmode;
+
+	bool ok = false;
+	std::string result;
+
+	compile_job(lua_State *L, const std::weak_ptr<char> &lifetime, int ref, const char *filename, const char *mode) : L(L), lifetime(lifetime), ref(ref), filename(filename), hasmode(mode != nullptr)
+	{
+		if(mode)
+		{
+			this->mode = mode;
+		}
+	}
+
+	// runs on the worker thread in a private state
+	void compile()
+	{
+		lua_State *C = luaL_newstate();
+		if(!C)
+		{
+			result = "not enough memory";
+			return;
+		}
+		if(lua::compiler::loadfile(C, filename.c_str(), hasmode ? mode.c_str() : nullptr) == LUA_OK)
+		{
+			ok = lua_dump(C, dumpwriter, &result, 0) == 0;
+			if(!ok)
+			{
+				result = "unable to dump the compiled chunk";
+			}
+		}else{
+			const char *msg = lua_tostring(C, -1);
+			result = msg ? msg : "unknown error";
+		}
+		lua_close(C);
+	}
+
+	// runs on the server thread
+	void deliver()
+	{
+		auto lock = lifetime.lock();
+		if(!lock)
+		{
+			return;
+		}
+		lua::stackguard guard(L);
+		luaL_checkstack(L, 3, nullptr);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, ref);
+		if(ok)
+		{
+			std::string chunkname = "@" + filename;
+			if(luaL_loadbufferx(L, result.data(), result.size(), chunkname.c_str(), "b") == LUA_OK)
+			{
+				lua_pushlstring(L, filename.data(), filename.size());
+			}else{
+				lua_pushnil(L);
+				lua_insert(L, -2);
+			}
+		}else{
+			lua_pushnil(L);
+			lua_pushlstring(L, result.data(), result.size());
+		}
+		int err = lua_pcall(L, 2, 0, 0);
+		if(err != LUA_OK)
+		{
+			lua::report_error(L, err);
+		}
+	}
+};
+
+class compile_worker
+{
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::thread thread;
+	bool stopping = false;
+	std::queue<std::unique_ptr<compile_job>> pending;
+	std::queue<std::unique_ptr<compile_job>> finished;
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!stopping)
+		{
+			if(pending.empty())
+			{
+				signal.wait(lock);
+				continue;
+			}
+			auto job = std::move(pending.front());
+			pending.pop();
+			lock.unlock();
+			job->compile();
+			lock.lock();
+			if(!stopping)
+			{
+				finished.push(std::move(job));
+			}
+		}
+	}
+
+public:
+	~compile_worker()
+	{
+		stop();
+	}
+
+	void add(std::unique_ptr<compile_job> &&job)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!thread.joinable())
+		{
+			stopping = false;
+			thread = std::thread(&compile_worker::run, this);
+		}
+		pending.push(std::move(job));
+		signal.notify_one();
+	}
+
+	void tick()
+	{
+		decltype(finished) queue;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(finished.empty())
+			{
+				return;
+			}
+			finished.swap(queue);
+		}
+		while(!queue.empty())
+		{
+			auto job = std::move(queue.front());
+			queue.pop();
+			job->deliver();
+		}
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			decltype(pending)().swap(pending);
+			decltype(finished)().swap(finished);
+			signal.notify_one();
+		}
+		if(thread.joinable())
+		{
+			thread.join();
+		}
+	}
+};
+
+static compile_worker worker;
+
+static int loadfileasync(lua_State *L)
+{
+	const char *filename = luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	const char *mode = luaL_optstring(L, 3, nullptr);
+	auto &lifetime = lua::touserdata<std::shared_ptr<char>>(L, lua_upvalueindex(1));
+	lua_pushvalue(L, 2);
+	int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	worker.add(std::unique_ptr<compile_job>(new compile_job(lua::mainthread(L), lifetime, ref, filename, mode)));
+	return 0;
+}
+
+static int loadasync(lua_State *L)
+{
+	luaL_checkstring(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+	lua_getfield(L, lua_upvalueindex(2), "searchpath");
+	lua_pushvalue(L, 1);
+	lua_getfield(L, lua_upvalueindex(2), "path");
+	lua_call(L, 2, 2);
+	if(lua_isnil(L, 3))
+	{
+		// the error message is passed to the callback like compilation errors
+		return lua::tailcall(L, 2, 0);
+	}
+	lua_pop(L, 1);
+	lua_replace(L, 1);
+	return loadfileasync(L);
+}
+
+static int searcher(lua_State *L)
+{
+	const char *name = luaL_checkstring(L, 1);
+	lua_settop(L, 1);
+	lua_getfield(L, lua_upvalueindex(1), "searchpath");
+	lua_pushvalue(L, 1);
+	lua_getfield(L, lua_upvalueindex(1), "path");
+	lua_call(L, 2, 2);
+	if(lua_isnil(L, 2))
+	{
+		return 1;
+	}
+	lua_pop(L, 1);
+	const char *filename = lua_tostring(L, 2);
+	if(lua::compiler::loadfile(L, filename, nullptr) == LUA_OK)
+	{
+		lua_pushvalue(L, 2);
+		return 2;
+	}
+	return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, filename, lua_tostring(L, -1));
+}
+
+static int cachestats(lua_State *L)
+{
+	size_t hits, misses, entries;
+	lua::compiler::getcachestats(hits, misses, entries);
+	lua_pushinteger(L, (lua_Integer)hits);
+	lua_pushinteger(L, (lua_Integer)misses);
+	lua_pushinteger(L, (lua_Integer)entries);
+	return 3;
+}
+
+void lua::compiler::init_package(lua_State *L, int table)
+{
+	table = lua_absindex(L, table);
+	lua::pushuserdata(L, std::make_shared<char>());
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, loadfileasync, 1);
+	lua_setfield(L, table, "loadfileasync");
+	lua_pushvalue(L, table);
+	lua_pushcclosure(L, loadasync, 2);
+	lua_setfield(L, table, "loadasync");
+	lua_pushcfunction(L, cachestats);
+	lua_setfield(L, table, "cachestats");
+
+	// the Lua file searcher is replaced by one that uses the shared cache
+	lua_getfield(L, table, "searchers");
+	lua_pushvalue(L, table);
+	lua_pushcclosure(L, searcher, 1);
+	lua_rawseti(L, -2, 2);
+	lua_pop(L, 1);
+}
+
+void lua::compiler::close()
+{
+	worker.stop();
+}
+
+void lua::compiler::tick()
+{
+	worker.tick();
+}
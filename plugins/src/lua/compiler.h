@@ -0,0 +1,21 @@
+#ifndef COMPILER_H_INCLUDED
+#define COMPILER_H_INCLUDED
+
+#include "lua/lualibs.h"
+#include <string>
+
+namespace lua
+{
+	namespace compiler
+	{
+		void init_package(lua_State *L, int table);
+		void close();
+		void tick();
+		int loadfile(lua_State *L, const char *filename, const char *mode);
+		int loadstring(lua_State *L, const std::string &code, const char *chunkname, const char *mode);
+		void setcachedir(const char *dir);
+		void getcachestats(size_t &hits, size_t &misses, size_t &entries);
+	}
+}
+
+#endif
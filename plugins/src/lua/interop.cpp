@@ -12,6 +12,7 @@
 #include "interop/file.h"
 #include "interop/tags.h"
 #include "interop/sleep.h"
+#include "interop/router.h"
 
 #include <unordered_map>
 #include <memory>
@@ -25,6 +26,7 @@ class amx_info
 public:
 	lua_State *L;
 	std::string fs_name;
+	bool shared = false;
 	int self = 0;
 	AMX *amx = nullptr;
 
@@ -36,7 +38,11 @@ public:
 	~amx_info()
 	{
 		amx_map.erase(amx);
-		if(amx && !fs_name.empty() && amx::Unload(fs_name.c_str()))
+		if(amx && shared)
+		{
+			lua::interop::router_detach(amx);
+			amx = nullptr;
+		}else if(amx && !fs_name.empty() && amx::Unload(fs_name.c_str()))
 		{
 			amx = nullptr;
 		}
@@ -188,6 +194,15 @@ int lua::interop::loader(lua_State *L)
 	if(amx)
 	{
 		loader(amx, nullptr);
+	}else if(router_shared())
+	{
+		amx = router_attach(std::move(loader));
+		if(!amx)
+		{
+			lua_pop(L, 1);
+			return 0;
+		}
+		info.shared = true;
 	}else{
 		info.fs_name = "?luafs_";
 		info.fs_name.append(std::to_string(reinterpret_cast<intptr_t>(&info)));
@@ -209,6 +224,11 @@ bool lua::interop::amx_get_addr(AMX *amx, cell amx_addr, cell **phys_addr)
 
 void lua::interop::amx_unload(AMX *amx)
 {
+	if(router_unload(amx))
+	{
+		amx_unregister_natives(amx);
+		return;
+	}
 	auto it = amx_map.find(amx);
 	if(it != amx_map.end())
 	{
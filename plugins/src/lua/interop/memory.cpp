@@ -455,42 +455,45 @@ int vacall(lua_State *L)
 
 		bool restore = lua::numresults(L) != 0;
 
-		auto restorers = std::make_shared<std::vector<void(*)(lua_State *L, cell value)>>();
+		// when restoring, every value is followed by a cell storing its type
+		size_t stride = restore ? 2 : 1;
 
 		int args = lua_gettop(L);
 		for(int i = 1; i <= args; i++)
 		{
-			if(!amx::MemCheck(amx, 0))
+			if(!amx::MemCheck(amx, (stride - 1) * sizeof(cell)))
 			{
 				return lua::amx_error(L, AMX_ERR_STACKERR);
 			}
 
 			cell value = 0;
+			int type = lua_type(L, i);
 			
 			if(lua_isinteger(L, i))
 			{
 				value = (cell)lua_tointeger(L, i);
-				if(restore) restorers->push_back([](lua_State *L, cell value){ lua_pushinteger(L, value); });
-			}else if(lua::isnumber(L, i))
+			}else if(type == LUA_TNUMBER)
 			{
 				float num = (float)lua_tonumber(L, i);
 				value = amx_ftoc(num);
-				if(restore) restorers->push_back([](lua_State *L, cell value){ lua_pushnumber(L, amx_ctof(value)); });
-			}else if(lua_isboolean(L, i))
+			}else if(type == LUA_TBOOLEAN)
 			{
 				value = lua_toboolean(L, i);
-				if(restore) restorers->push_back([](lua_State *L, cell value){ lua_pushboolean(L, value); });
-			}else if(lua_islightuserdata(L, i))
+			}else if(type == LUA_TLIGHTUSERDATA)
 			{
 				value = reinterpret_cast<cell>(lua_touserdata(L, i));
-				if(restore) restorers->push_back([](lua_State *L, cell value){ lua_pushlightuserdata(L, reinterpret_cast<void*>(value)); });
 			}else{
 				continue;
 			}
 
 			lua_pushlightuserdata(L, reinterpret_cast<void*>(amx->hea));
-			*(heap++) = value;
-			amx->hea += sizeof(cell);
+			heap[0] = value;
+			if(restore)
+			{
+				heap[1] = lua_isinteger(L, i) ? LUA_TNONE : type;
+			}
+			heap += stride;
+			amx->hea += stride * sizeof(cell);
 
 			lua_replace(L, i);
 		}
@@ -499,7 +502,7 @@ int vacall(lua_State *L)
 		lua_rotate(L, 1, num);
 		return lua::pcallk(L, lua_gettop(L) - 1, restore ? LUA_MULTRET : 0, 0, [=](lua_State *L, int status)
 		{
-			int heapsize = (amx->hea - old_hea) / sizeof(cell);
+			int heapsize = (amx->hea - old_hea) / (stride * sizeof(cell));
 			amx->hea = old_hea;
 			switch(status)
 			{
@@ -509,7 +512,7 @@ int vacall(lua_State *L)
 					int nr = lua::numresults(L);
 					if(nr == LUA_MULTRET)
 					{
-						nr = restorers->size();
+						nr = heapsize;
 					}else{
 						nr -= lua_gettop(L);
 					}
@@ -519,9 +522,23 @@ int vacall(lua_State *L)
 					}
 					auto heap = reinterpret_cast<cell*>(data + amx->hea);
 					luaL_checkstack(L, nr, nullptr);
-					for(int i = 0; i < nr; i++)
+					for(int i = 0; i < nr; i++, heap += stride)
 					{
-						(*restorers)[i](L, heap[i]);
+						switch(heap[1])
+						{
+							case LUA_TNONE:
+								lua_pushinteger(L, heap[0]);
+								break;
+							case LUA_TNUMBER:
+								lua_pushnumber(L, amx_ctof(heap[0]));
+								break;
+							case LUA_TBOOLEAN:
+								lua_pushboolean(L, heap[0]);
+								break;
+							default:
+								lua_pushlightuserdata(L, reinterpret_cast<void*>(heap[0]));
+								break;
+						}
 					}
 					return lua_gettop(L);
 				}
@@ -10,7 +10,7 @@
 #include <cstring>
 
 static std::unordered_map<AMX*, std::shared_ptr<struct amx_native_info>> amx_map;
-static std::unordered_set<cell> addr_set;
+static std::unordered_map<AMX*, std::unordered_set<cell>> addr_map;
 
 struct amx_native_info
 {
@@ -42,9 +42,20 @@ public:
 		amx->hea = hea;
 		amx->stk = stk;
 
-		for(const cell &value : reset_addr)
+		if(!reset_addr.empty())
 		{
-			addr_set.erase(value);
+			auto it = addr_map.find(amx);
+			if(it != addr_map.end())
+			{
+				for(const cell &value : reset_addr)
+				{
+					it->second.erase(value);
+				}
+				if(it->second.empty())
+				{
+					addr_map.erase(it);
+				}
+			}
 		}
 	}
 };
@@ -138,7 +149,7 @@ static int __call(lua_State *L)
 							value = reinterpret_cast<unsigned char*>(buf) - data;
 							if(value < 0 || value >= amx->stp)
 							{
-								if(addr_set.insert(value).second)
+								if(addr_map[amx].insert(value).second)
 								{
 									amx_guard.reset_addr.push_back(value);
 								}
@@ -370,10 +381,411 @@ static int __call_fast(lua_State *L)
 	return 0;
 }
 
+struct native_signature
+{
+	AMX *amx = nullptr;
+	AMX_NATIVE native = nullptr;
+	std::vector<char> params;
+	int numargs = 0;
+	int numouts = 0;
+	char result = 'h';
+	bool amxmem = false;
+
+	bool parse(const char *sig)
+	{
+		for(; *sig && *sig != ':'; sig++)
+		{
+			switch(*sig)
+			{
+				case 's':
+					amxmem = true;
+					// fall through
+				case 'i':
+				case 'f':
+				case 'b':
+				case 'h':
+					numargs++;
+					break;
+				case 'I':
+				case 'F':
+				case 'B':
+				case 'H':
+					amxmem = true;
+					numouts++;
+					break;
+				default:
+					return false;
+			}
+			params.push_back(*sig);
+		}
+		if(*sig == ':')
+		{
+			switch(result = *++sig)
+			{
+				case 'i':
+				case 'f':
+				case 'b':
+				case 'h':
+				case 'v':
+					break;
+				default:
+					return false;
+			}
+			if(*++sig)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+inline void push_cell(lua_State *L, char kind, cell value)
+{
+	switch(kind)
+	{
+		case 'i':
+		case 'I':
+			lua_pushinteger(L, value);
+			break;
+		case 'f':
+		case 'F':
+			lua_pushnumber(L, amx_ctof(value));
+			break;
+		case 'b':
+		case 'B':
+			lua_pushboolean(L, value);
+			break;
+		default:
+			lua_pushlightuserdata(L, reinterpret_cast<void*>(value));
+			break;
+	}
+}
+
+static void marshal_sig(lua_State *L, const native_signature &sig, int arg, AMX *amx, unsigned char *data, cell *params)
+{
+	int paramcount = (int)sig.params.size();
+	params[0] = paramcount * sizeof(cell);
+	arg--;
+	for(int i = 0; i < paramcount; i++)
+	{
+		cell &value = params[i + 1];
+		switch(sig.params[i])
+		{
+			case 'i':
+			{
+				auto num = luaL_checkinteger(L, ++arg);
+				if(num < std::numeric_limits<cell>::min() || num > std::numeric_limits<ucell>::max())
+				{
+					lua::argerror(L, arg, "%I cannot be stored in a single cell", num);
+				}
+				value = (cell)num;
+				break;
+			}
+			case 'f':
+			{
+				float num = (float)luaL_checknumber(L, ++arg);
+				value = amx_ftoc(num);
+				break;
+			}
+			case 'b':
+				value = lua_toboolean(L, ++arg);
+				break;
+			case 'h':
+				if(lua_islightuserdata(L, ++arg))
+				{
+					value = reinterpret_cast<cell>(lua_touserdata(L, arg));
+				}else if(!marshal_value_simple(L, arg, value))
+				{
+					lua::argerrortype(L, arg, "simple type");
+				}
+				break;
+			case 's':
+			{
+				size_t len;
+				auto str = luaL_checklstring(L, ++arg, &len);
+				auto dlen = ((len + sizeof(cell)) / sizeof(cell)) * sizeof(cell);
+				if(!amx::MemCheck(amx, dlen))
+				{
+					lua::amx_error(L, AMX_ERR_MEMORY);
+				}
+				value = amx->hea;
+				amx::SetString(reinterpret_cast<cell*>(data + amx->hea), str, len, true);
+				amx->hea += dlen;
+				break;
+			}
+			default:
+				if(!amx::MemCheck(amx, sizeof(cell)))
+				{
+					lua::amx_error(L, AMX_ERR_MEMORY);
+				}
+				value = amx->hea;
+				*reinterpret_cast<cell*>(data + amx->hea) = 0;
+				amx->hea += sizeof(cell);
+				break;
+		}
+	}
+}
+
+static cell *alloc_sig_params(lua_State *L, const native_signature &sig, AMX *amx, unsigned char *data, cell *local)
+{
+	if(sig.amxmem)
+	{
+		int paramcount = (int)sig.params.size();
+		if(!amx::MemCheck(amx, (paramcount + 1) * sizeof(cell)))
+		{
+			lua::amx_error(L, AMX_ERR_STACKERR);
+		}
+		amx->stk -= (paramcount + 1) * sizeof(cell);
+		return reinterpret_cast<cell*>(data + amx->stk);
+	}
+	return local;
+}
+
+static int __call_sig(lua_State *L)
+{
+	auto &sig = lua::touserdata<native_signature>(L, lua_upvalueindex(1));
+	auto amx = sig.amx;
+	int paramcount = (int)sig.params.size();
+	lua_settop(L, sig.numargs);
+
+	int errorcode;
+	cell result;
+	bool sleeping;
+	{
+		amx_stackguard amx_guard(amx);
+		auto hdr = (AMX_HEADER*)amx->base;
+		auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+
+		cell *local = sig.amxmem ? nullptr : reinterpret_cast<cell*>(alloca(sizeof(cell) * (paramcount + 1)));
+		cell *params = alloc_sig_params(L, sig, amx, data, local);
+		marshal_sig(L, sig, 1, amx, data, params);
+
+		amx->error = 0;
+
+		{
+			lua::jumpguard guard(L);
+			result = sig.native(amx, params);
+		}
+
+		errorcode = amx->error;
+		// like in __call, a native sleeping in a coroutine yields; the outputs are read before the memory is released
+		sleeping = errorcode == AMX_ERR_SLEEP && lua_isyieldable(L);
+
+		if(!errorcode || sleeping)
+		{
+			luaL_checkstack(L, sig.numouts + 2, nullptr);
+			if(sig.result != 'v' && !sleeping)
+			{
+				push_cell(L, sig.result, result);
+			}
+			if(sig.numouts > 0)
+			{
+				for(int i = 0; i < paramcount; i++)
+				{
+					char kind = sig.params[i];
+					if(kind >= 'A' && kind <= 'Z')
+					{
+						push_cell(L, kind, *reinterpret_cast<cell*>(data + params[i + 1]));
+					}
+				}
+			}
+		}
+	}
+
+	if(sleeping)
+	{
+		lua_pushvalue(L, lua_upvalueindex(2));
+		lua_pushlightuserdata(L, reinterpret_cast<void*>(result));
+		return lua_yieldk(L, 2, 0, [](lua_State *L, int status, lua_KContext ctx)
+		{
+			// the first value passed to the continuation is the result of the native
+			auto &sig = lua::touserdata<native_signature>(L, lua_upvalueindex(1));
+			lua_settop(L, sig.numargs + sig.numouts + 1);
+			if(sig.result == 'v')
+			{
+				lua_pop(L, 1);
+			}else{
+				if(lua_islightuserdata(L, -1))
+				{
+					cell value = reinterpret_cast<cell>(lua_touserdata(L, -1));
+					lua_pop(L, 1);
+					push_cell(L, sig.result, value);
+				}
+				lua_insert(L, sig.numargs + 1);
+			}
+			return lua_gettop(L) - sig.numargs;
+		});
+	}
+	if(errorcode)
+	{
+		return lua::amx_error(L, errorcode, result);
+	}
+	return lua_gettop(L) - sig.numargs;
+}
+
+static int batch(lua_State *L)
+{
+	const native_signature *psig;
+	native_signature parsed;
+	int first;
+	if(lua_tocfunction(L, 1) == __call_sig)
+	{
+		lua_getupvalue(L, 1, 1);
+		psig = &lua::touserdata<native_signature>(L, -1);
+		lua_replace(L, 1);
+		first = 2;
+	}else{
+		auto &info = lua::touserdata<std::shared_ptr<amx_native_info>>(L, lua_upvalueindex(1));
+		auto name = luaL_checkstring(L, 1);
+		auto it = info->natives.find(name);
+		if(it == info->natives.end())
+		{
+			return luaL_argerror(L, 1, "native not found");
+		}
+		parsed.amx = info->amx;
+		parsed.native = it->second.first;
+		if(!parsed.parse(luaL_checkstring(L, 2)))
+		{
+			return luaL_argerror(L, 2, "invalid signature");
+		}
+		psig = &parsed;
+		first = 3;
+	}
+	const native_signature &sig = *psig;
+	auto amx = sig.amx;
+	int paramcount = (int)sig.params.size();
+
+	// either an array of argument tuples, or one column (or broadcast scalar) per argument
+	bool rows = false;
+	if(lua_gettop(L) == first && lua_istable(L, first))
+	{
+		rows = lua_rawgeti(L, first, 1) == LUA_TTABLE;
+		lua_pop(L, 1);
+	}
+	if(!rows)
+	{
+		lua_settop(L, first - 1 + sig.numargs);
+	}
+	lua_Integer count = 0;
+	if(rows)
+	{
+		count = luaL_len(L, first);
+	}else{
+		bool columns = false;
+		for(int i = 0; i < sig.numargs; i++)
+		{
+			if(lua_istable(L, first + i))
+			{
+				columns = true;
+				auto len = luaL_len(L, first + i);
+				if(len > count) count = len;
+			}
+		}
+		if(!columns)
+		{
+			// only scalars, so the call is made once
+			count = 1;
+		}
+	}
+
+	int stride = (sig.result != 'v' ? 1 : 0) + sig.numouts;
+	lua_getfield(L, lua_upvalueindex(2), "newbuffer");
+	lua_pushinteger(L, count * stride);
+	lua_call(L, 1, 1);
+	auto out = reinterpret_cast<cell*>(lua_touserdata(L, -1));
+	int top = lua_gettop(L);
+	luaL_checkstack(L, sig.numargs + 1, nullptr);
+
+	{
+		amx_stackguard amx_guard(amx);
+		auto hdr = (AMX_HEADER*)amx->base;
+		auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+
+		cell *local = sig.amxmem ? nullptr : reinterpret_cast<cell*>(alloca(sizeof(cell) * (paramcount + 1)));
+		cell *params = alloc_sig_params(L, sig, amx, data, local);
+		cell hea = amx->hea;
+
+		for(lua_Integer n = 1; n <= count; n++)
+		{
+			if(rows)
+			{
+				lua_rawgeti(L, first, n);
+				for(int i = 1; i <= sig.numargs; i++)
+				{
+					lua_geti(L, top + 1, i);
+				}
+				lua_remove(L, top + 1);
+			}else{
+				for(int i = 0; i < sig.numargs; i++)
+				{
+					if(lua_istable(L, first + i))
+					{
+						lua_geti(L, first + i, n);
+					}else{
+						lua_pushvalue(L, first + i);
+					}
+				}
+			}
+			marshal_sig(L, sig, top + 1, amx, data, params);
+
+			amx->error = 0;
+			cell result;
+			{
+				lua::jumpguard guard(L);
+				result = sig.native(amx, params);
+			}
+			if(amx->error)
+			{
+				return lua::amx_error(L, amx->error, result);
+			}
+
+			if(sig.result != 'v')
+			{
+				*out++ = result;
+			}
+			if(sig.numouts > 0)
+			{
+				for(int i = 0; i < paramcount; i++)
+				{
+					char kind = sig.params[i];
+					if(kind >= 'A' && kind <= 'Z')
+					{
+						*out++ = *reinterpret_cast<cell*>(data + params[i + 1]);
+					}
+				}
+			}
+			lua_settop(L, top);
+			amx->hea = hea;
+		}
+	}
+	return 1;
+}
+
 static int getnative(lua_State *L)
 {
 	auto &info = lua::touserdata<std::shared_ptr<amx_native_info>>(L, lua_upvalueindex(1));
 	auto name = luaL_checkstring(L, 1);
+	if(lua::isstring(L, 2))
+	{
+		auto it = info->natives.find(name);
+		if(it != info->natives.end())
+		{
+			native_signature sig;
+			sig.amx = info->amx;
+			sig.native = it->second.first;
+			if(!sig.parse(lua_tostring(L, 2)))
+			{
+				return luaL_argerror(L, 2, "invalid signature");
+			}
+			lua::pushuserdata(L, std::move(sig));
+			lua_pushvalue(L, lua_upvalueindex(2));
+			lua_pushcclosure(L, __call_sig, 2);
+			return 1;
+		}
+		lua_pushnil(L);
+		return 1;
+	}
 	bool fast = luaL_opt(L, lua::checkboolean, 2, false);
 	auto it = info->natives.find(name);
 	if(it != info->natives.end())
@@ -524,6 +936,11 @@ void lua::interop::init_native(lua_State *L, AMX *amx)
 
 	lua_pushcfunction(L, marshal);
 	lua_setfield(L, table, "marshal");
+
+	lua::pushuserdata(L, it->second);
+	lua_pushvalue(L, table);
+	lua_pushcclosure(L, batch, 2);
+	lua_setfield(L, table, "batch");
 }
 
 void lua::interop::amx_register_natives(AMX *amx, const AMX_NATIVE_INFO *nativelist, int number)
@@ -544,7 +961,12 @@ void lua::interop::amx_register_natives(AMX *amx, const AMX_NATIVE_INFO *nativel
 
 bool lua::interop::amx_get_param_addr(AMX *amx, cell amx_addr, cell **phys_addr)
 {
-	if(phys_addr && addr_set.find(amx_addr) != addr_set.end())
+	if(addr_map.empty() || !phys_addr)
+	{
+		return false;
+	}
+	auto it = addr_map.find(amx);
+	if(it != addr_map.end() && it->second.find(amx_addr) != it->second.end())
 	{
 		auto hdr = (AMX_HEADER*)amx->base;
 		auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
@@ -554,6 +976,18 @@ bool lua::interop::amx_get_param_addr(AMX *amx, cell amx_addr, cell **phys_addr)
 	return false;
 }
 
+void lua::interop::amx_copy_natives(AMX *from, AMX *to)
+{
+	auto info = std::make_shared<amx_native_info>(to);
+	auto it = amx_map.find(from);
+	if(it != amx_map.end())
+	{
+		info->native_batches = it->second->native_batches;
+		info->natives = it->second->natives;
+	}
+	amx_map[to] = std::move(info);
+}
+
 void lua::interop::amx_unregister_natives(AMX *amx)
 {
 	auto it = amx_map.find(amx);
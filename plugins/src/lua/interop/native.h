@@ -11,6 +11,7 @@ namespace lua
 		void init_native(lua_State *L, AMX *amx);
 		void amx_register_natives(AMX *amx, const AMX_NATIVE_INFO *nativelist, int number);
 		bool amx_get_param_addr(AMX *amx, cell amx_addr, cell **phys_addr);
+		void amx_copy_natives(AMX *from, AMX *to);
 		void amx_unregister_natives(AMX *amx);
 		AMX_NATIVE find_native(AMX *amx, const char *native);
 	}
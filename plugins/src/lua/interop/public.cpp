@@ -4,12 +4,21 @@
 #include "sleep.h"
 
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <cstring>
 #include <limits>
+#include <string>
+#include <vector>
 
 static std::unordered_map<AMX*, std::weak_ptr<struct amx_public_info>> amx_map;
 
+// incremented when a public may have been added to or removed from any state
+static unsigned int generation = 0;
+
+// names probed by the host are not limited, so the set of missing ones is dropped when it grows too large
+static const size_t missing_max = 1024;
+
 struct amx_public_info
 {
 	AMX *amx;
@@ -20,11 +29,48 @@ struct amx_public_info
 	int publiclist;
 	int contlist;
 
+	struct entry
+	{
+		int ref = LUA_NOREF;
+		std::string name;
+	};
+
+	std::unordered_map<std::string, int> names;
+	std::unordered_set<std::string> missing;
+	std::vector<entry> dispatch;
+	std::string key;
+	size_t cache_hits = 0;
+	size_t cache_misses = 0;
+	int depth = 0;
+
 	amx_public_info(lua_State *L, AMX *amx) : L(L), amx(amx)
 	{
 
 	}
 
+	void cache(lua_State *L, int index, const char *name)
+	{
+		int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		if((size_t)index >= dispatch.size())
+		{
+			dispatch.resize(index + 1);
+		}else if(dispatch[index].ref != LUA_NOREF)
+		{
+			luaL_unref(L, LUA_REGISTRYINDEX, dispatch[index].ref);
+		}
+		dispatch[index].ref = ref;
+		dispatch[index].name.assign(name);
+		names[name] = index;
+	}
+
+	void uncache(lua_State *L, int index)
+	{
+		auto &ref = dispatch[index].ref;
+		luaL_unref(L, LUA_REGISTRYINDEX, ref);
+		ref = LUA_NOREF;
+		generation++;
+	}
+
 	~amx_public_info()
 	{
 		if(amx)
@@ -35,6 +81,31 @@ struct amx_public_info
 	}
 };
 
+// new keys are seen here; the metatable is left open, so the table can still be used as a normal one
+static int public_newindex(lua_State *L)
+{
+	lua_settop(L, 3);
+	// a name may also be provided by an __index set later, so all missing names are checked again
+	auto &info = lua::touserdata<std::shared_ptr<amx_public_info>>(L, lua_upvalueindex(1));
+	info->missing.clear();
+	lua_rawset(L, 1);
+	generation++;
+	return 0;
+}
+
+static int publicstats(lua_State *L)
+{
+	auto &info = lua::touserdata<std::shared_ptr<amx_public_info>>(L, lua_upvalueindex(1));
+	lua_pushinteger(L, (lua_Integer)info->cache_hits);
+	lua_pushinteger(L, (lua_Integer)info->cache_misses);
+	if(lua_toboolean(L, 1))
+	{
+		info->cache_hits = 0;
+		info->cache_misses = 0;
+	}
+	return 2;
+}
+
 void lua::interop::init_public(lua_State *L, AMX *amx)
 {
 	int table = lua_absindex(L, -1);
@@ -42,8 +113,14 @@ void lua::interop::init_public(lua_State *L, AMX *amx)
 	auto info = std::make_shared<amx_public_info>(lua::mainthread(L), amx);
 	amx_map[amx] = info;
 	lua::pushuserdata(L, info);
+	int self = lua_absindex(L, -1);
 
 	lua_getfield(L, table, "public");
+	lua_createtable(L, 0, 1);
+	lua_pushvalue(L, self);
+	lua_pushcclosure(L, public_newindex, 1);
+	lua_setfield(L, -2, "__newindex");
+	lua_setmetatable(L, -2);
 	info->publictable = luaL_ref(L, LUA_REGISTRYINDEX);
 
 	lua_newtable(L);
@@ -52,6 +129,10 @@ void lua::interop::init_public(lua_State *L, AMX *amx)
 	lua_newtable(L);
 	info->contlist = luaL_ref(L, LUA_REGISTRYINDEX);
 
+	lua_pushvalue(L, self);
+	lua_pushcclosure(L, publicstats, 1);
+	lua_setfield(L, table, "publicstats");
+
 	info->self = luaL_ref(L, LUA_REGISTRYINDEX);
 }
 
@@ -59,7 +140,21 @@ bool getpublic(lua_State *L, const char *name, int index, int &error)
 {
 	if(lua_rawgeti(L, LUA_REGISTRYINDEX, index) == LUA_TTABLE)
 	{
-		error = lua::pgetfield(L, -1, name);
+		bool meta = false;
+		if(lua_getmetatable(L, -1))
+		{
+			meta = lua_getfield(L, -1, "__index") != LUA_TNIL;
+			lua_pop(L, 2);
+		}
+		if(meta)
+		{
+			error = lua::pgetfield(L, -1, name);
+		}else{
+			// no metamethods can be invoked
+			lua_pushstring(L, name);
+			lua_rawget(L, -2);
+			error = LUA_OK;
+		}
 		if(error != LUA_OK || !lua_isfunction(L, -1))
 		{
 			if(error != LUA_OK)
@@ -77,6 +172,19 @@ bool getpublic(lua_State *L, const char *name, int index, int &error)
 	return false;
 }
 
+bool getrawpublic(lua_State *L, const char *name, int index)
+{
+	bool found = false;
+	if(lua_rawgeti(L, LUA_REGISTRYINDEX, index) == LUA_TTABLE)
+	{
+		lua_pushstring(L, name);
+		found = lua_rawget(L, -2) == LUA_TFUNCTION;
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return found;
+}
+
 bool getpubliclist(lua_State *L, int index)
 {
 	if(lua_rawgeti(L, LUA_REGISTRYINDEX, index) == LUA_TTABLE)
@@ -98,11 +206,51 @@ bool lua::interop::amx_find_public(AMX *amx, const char *funcname, int *index, i
 			{
 				auto L = info->L;
 				lua::stackguard guard(L);
-				if(!lua_checkstack(L, 4))
+				if(!lua_checkstack(L, 5))
 				{
 					error = AMX_ERR_MEMORY;
 					return true;
 				}
+				// the table may be modified in any way, so the cached entries are only kept while they match its contents
+				info->key.assign(funcname);
+				auto name_it = info->names.find(info->key);
+				bool cached = name_it != info->names.end() && info->dispatch[name_it->second].ref != LUA_NOREF;
+				if(cached)
+				{
+					int cached_index = name_it->second;
+					int lerror;
+					bool valid = false;
+					if(getpublic(L, funcname, info->publictable, lerror))
+					{
+						lua_rawgeti(L, LUA_REGISTRYINDEX, info->dispatch[cached_index].ref);
+						valid = lua_rawequal(L, -1, -2);
+						lua_pop(L, 2);
+					}else if(lerror != LUA_OK)
+					{
+						error = AMX_ERR_GENERAL;
+						return true;
+					}
+					if(valid)
+					{
+						info->cache_hits++;
+						*index = cached_index;
+						error = AMX_ERR_NONE;
+						return true;
+					}
+					info->uncache(L, cached_index);
+				}else if(info->missing.find(info->key) != info->missing.end())
+				{
+					// only the table itself is checked, so a missing public never enters the VM;
+					// a public provided by __index is found after the next new key is assigned to the table
+					if(!getrawpublic(L, funcname, info->publictable))
+					{
+						info->cache_hits++;
+						error = AMX_ERR_INDEX;
+						return true;
+					}
+					info->missing.erase(info->key);
+				}
+				info->cache_misses++;
 				if(getpubliclist(L, info->publiclist))
 				{
 					bool indexed = false;
@@ -120,6 +268,8 @@ bool lua::interop::amx_find_public(AMX *amx, const char *funcname, int *index, i
 							if(lua_rawgeti(L, -2, *index) == LUA_TTABLE)
 							{
 								lua_insert(L, -2);
+								lua_pushvalue(L, -1);
+								info->cache(L, *index - 1, funcname);
 								lua_rawseti(L, -2, 1);
 								lua_pop(L, 2);
 								error = AMX_ERR_NONE;
@@ -130,10 +280,13 @@ bool lua::interop::amx_find_public(AMX *amx, const char *funcname, int *index, i
 						}else{
 							lua_createtable(L, 2, 0);
 							lua_insert(L, -2);
-							lua_rawseti(L, -2, 1);
+							lua_pushvalue(L, -1);
+							lua_rawseti(L, -3, 1);
 							lua_pushstring(L, funcname);
-							lua_rawseti(L, -2, 2);
-							*index = luaL_ref(L, -2);
+							lua_rawseti(L, -3, 2);
+							lua_insert(L, -2);
+							*index = luaL_ref(L, -3);
+							info->cache(L, *index - 1, funcname);
 							lua_pushinteger(L, *index);
 							lua_setfield(L, -2, funcname);
 							lua_pop(L, 1);
@@ -159,6 +312,11 @@ bool lua::interop::amx_find_public(AMX *amx, const char *funcname, int *index, i
 					}
 					lua_pop(L, 1);
 				}
+				if(info->missing.size() >= missing_max)
+				{
+					info->missing.clear();
+				}
+				info->missing.insert(funcname);
 				error = AMX_ERR_INDEX;
 				return true;
 			}
@@ -230,6 +388,124 @@ bool lua::interop::amx_num_publics(AMX *amx, int *number)
 	return false;
 }
 
+static int call_public(lua_State *L, AMX *amx, amx_public_info &info, cell *retval, bool cont)
+{
+	auto hdr = (AMX_HEADER*)amx->base;
+	auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+	auto stk = reinterpret_cast<cell*>(data + amx->stk);
+	cell reset_stk = amx->stk;
+	int paramcount;
+	if(cont)
+	{
+		paramcount = 1;
+		lua_pushlightuserdata(L, reinterpret_cast<void*>(amx->pri));
+	}else{
+		paramcount = amx->paramcount;
+		amx->paramcount = 0;
+		for(int i = 0; i < paramcount; i++)
+		{
+			cell value = stk[i];
+			lua_pushlightuserdata(L, reinterpret_cast<void*>(value));
+		}
+		reset_stk += paramcount * sizeof(cell);
+		amx->stk -= 3 * sizeof(cell);
+		*--stk = paramcount * sizeof(cell);
+		*--stk = 0;
+		*--stk = 0;
+		amx->frm = amx->stk;
+	}
+
+	if(info.depth == 0)
+	{
+		lua::resetsleep(L);
+	}
+	info.depth++;
+	int error = lua_pcall(L, paramcount, 1, 0);
+	info.depth--;
+	if(error == LUA_OK)
+	{
+		amx->cip = 0;
+		amx->error = AMX_ERR_NONE;
+		if(lua_isinteger(L, -1))
+		{
+			auto num = lua_tointeger(L, -1);
+			if(num < std::numeric_limits<cell>::min() || num > std::numeric_limits<ucell>::max())
+			{
+				logprintf("warning: cannot marshal return value (%lld cannot be stored in a single cell)", (long long)num);
+			}
+			amx->pri = (cell)num;
+		}else if(lua::isnumber(L, -1))
+		{
+			float num = (float)lua_tonumber(L, -1);
+			amx->pri = amx_ftoc(num);
+		}else if(lua_isboolean(L, -1))
+		{
+			amx->pri = lua_toboolean(L, -1);
+		}else if(lua_islightuserdata(L, -1))
+		{
+			amx->pri = reinterpret_cast<cell>(lua_touserdata(L, -1));
+		}else{
+			if(!lua_isnil(L, -1))
+			{
+				logprintf("warning: cannot marshal return type %s", luaL_typename(L, -1));
+			}
+			amx->pri = 0;
+		}
+		if(retval)
+		{
+			*retval = amx->pri;
+		}
+		lua_pop(L, 1);
+	}else{
+		switch(error)
+		{
+			case LUA_ERRMEM:
+				amx->error = AMX_ERR_MEMORY;
+				break;
+			case LUA_ERRRUN:
+				amx->error = AMX_ERR_GENERAL;
+				if(lua::tosleep(L, -1))
+				{
+					amx->error = AMX_ERR_SLEEP;
+					lua::interop::handle_sleep(L, amx, info.contlist);
+				}else if(lua_istable(L, -1))
+				{
+					if(lua_getfield(L, -1, "__amxerr") == LUA_TNUMBER)
+					{
+						amx->error = (int)lua_tointeger(L, -1);
+					}
+					lua_pop(L, 1);
+					// the return value of a failed native is still passed to the caller
+					if(lua_getfield(L, -1, "__retval") == LUA_TLIGHTUSERDATA)
+					{
+						amx->pri = reinterpret_cast<cell>(lua_touserdata(L, -1));
+					}
+					lua_pop(L, 1);
+				}
+				break;
+			default:
+				amx->error = AMX_ERR_GENERAL;
+				break;
+		}
+		if(amx->error != AMX_ERR_SLEEP)
+		{
+			lua::report_error(L, error);
+		}
+		if(retval)
+		{
+			*retval = amx->pri;
+		}
+		lua_pop(L, 1);
+	}
+	amx->stk = reset_stk;
+	return amx->error;
+}
+
+unsigned int lua::interop::public_generation()
+{
+	return generation;
+}
+
 bool lua::interop::amx_exec(AMX *amx, cell *retval, int index, int &result)
 {
 	auto it = amx_map.find(amx);
@@ -245,6 +521,27 @@ bool lua::interop::amx_exec(AMX *amx, cell *retval, int index, int &result)
 				return true;
 			}
 			bool cont = index == AMX_EXEC_CONT;
+			if(!cont && index >= 0 && (size_t)index < info->dispatch.size() && info->dispatch[index].ref != LUA_NOREF)
+			{
+				// the cached function is checked against the table, since the index may be kept by the caller
+				auto &entry = info->dispatch[index];
+				int lerror;
+				if(getpublic(L, entry.name.c_str(), info->publictable, lerror))
+				{
+					lua_pushvalue(L, -1);
+					lua_rawseti(L, LUA_REGISTRYINDEX, entry.ref);
+					result = call_public(L, amx, *info, retval, false);
+					return true;
+				}
+				if(lerror != LUA_OK)
+				{
+					result = amx->error = AMX_ERR_GENERAL;
+					return true;
+				}
+				info->uncache(L, index);
+				result = amx->error = AMX_ERR_INDEX;
+				return true;
+			}
 			if(cont || getpubliclist(L, info->publiclist))
 			{
 				int tt = cont ? lua_rawgeti(L, LUA_REGISTRYINDEX, info->contlist) : lua_rawgeti(L, -1, index + 1);
@@ -277,101 +574,8 @@ bool lua::interop::amx_exec(AMX *amx, cell *retval, int index, int &result)
 					}
 					if(tt == LUA_TFUNCTION)
 					{
-						auto hdr = (AMX_HEADER*)amx->base;
-						auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
-						auto stk = reinterpret_cast<cell*>(data + amx->stk);
-						cell reset_stk = amx->stk;
-						int paramcount;
-						if(cont)
-						{
-							paramcount = 1;
-							lua_pushlightuserdata(L, reinterpret_cast<void*>(amx->pri));
-						}else{
-							paramcount = amx->paramcount;
-							amx->paramcount = 0;
-							for(int i = 0; i < paramcount; i++)
-							{
-								cell value = stk[i];
-								lua_pushlightuserdata(L, reinterpret_cast<void*>(value));
-							}
-							reset_stk += paramcount * sizeof(cell);
-							amx->stk -= 3 * sizeof(cell);
-							*--stk = paramcount * sizeof(cell);
-							*--stk = 0;
-							*--stk = 0;
-							amx->frm = amx->stk;
-						}
-
-						int error = lua_pcall(L, paramcount, 1, 0);
-						if(error == LUA_OK)
-						{
-							amx->cip = 0;
-							amx->error = AMX_ERR_NONE;
-							if(lua_isinteger(L, -1))
-							{
-								auto num = lua_tointeger(L, -1);
-								if(num < std::numeric_limits<cell>::min() || num > std::numeric_limits<ucell>::max())
-								{
-									logprintf("warning: cannot marshal return value (%lld cannot be stored in a single cell)", (long long)num);
-								}
-								amx->pri = (cell)num;
-							}else if(lua::isnumber(L, -1))
-							{
-								float num = (float)lua_tonumber(L, -1);
-								amx->pri = amx_ftoc(num);
-							}else if(lua_isboolean(L, -1))
-							{
-								amx->pri = lua_toboolean(L, -1);
-							}else if(lua_islightuserdata(L, -1))
-							{
-								amx->pri = reinterpret_cast<cell>(lua_touserdata(L, -1));
-							}else{
-								if(!lua_isnil(L, -1))
-								{
-									logprintf("warning: cannot marshal return type %s", luaL_typename(L, -1));
-								}
-								amx->pri = 0;
-							}
-							if(retval)
-							{
-								*retval = amx->pri;
-							}
-							lua_pop(L, 1);
-						}else{
-							switch(error)
-							{
-								case LUA_ERRMEM:
-									amx->error = AMX_ERR_MEMORY;
-									break;
-								case LUA_ERRRUN:
-									amx->error = AMX_ERR_GENERAL;
-									if(lua_istable(L, -1))
-									{
-										if(lua_getfield(L, -1, "__amxerr") == LUA_TNUMBER)
-										{
-											amx->error = (int)lua_tointeger(L, -1);
-										}
-										lua_pop(L, 1);
-										lua::interop::handle_sleep(L, amx, info->contlist);
-									}
-									break;
-								default:
-									amx->error = AMX_ERR_GENERAL;
-									break;
-							}
-							if(amx->error != AMX_ERR_SLEEP)
-							{
-								lua::report_error(L, error);
-							}
-							if(retval)
-							{
-								*retval = amx->pri;
-							}
-							lua_pop(L, 1);
-						}
-						amx->stk = reset_stk;
+						result = call_public(L, amx, *info, retval, cont);
 						lua_pop(L, cont ? 1 : 2);
-						result = amx->error;
 						return true;
 					}
 					lua_pop(L, 1);
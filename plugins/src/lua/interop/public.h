@@ -13,6 +13,7 @@ namespace lua
 		bool amx_get_public(AMX *amx, int index, char *funcname);
 		bool amx_num_publics(AMX *amx, int *number);
 		bool amx_exec(AMX *amx, cell *retval, int index, int &result);
+		unsigned int public_generation();
 	}
 }
 
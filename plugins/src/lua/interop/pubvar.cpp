@@ -7,7 +7,7 @@
 #include <cstring>
 
 static std::unordered_map<AMX*, std::weak_ptr<struct amx_pubvar_info>> amx_map;
-static std::unordered_map<cell, std::weak_ptr<cell>> addr_map;
+static std::unordered_map<AMX*, std::unordered_map<cell, std::weak_ptr<cell>>> addr_map;
 
 struct amx_pubvar_info
 {
@@ -28,6 +28,7 @@ struct amx_pubvar_info
 		if(amx)
 		{
 			amx_map.erase(amx);
+			addr_map.erase(amx);
 			amx = nullptr;
 		}
 	}
@@ -115,11 +116,12 @@ bool lua::interop::amx_find_pubvar(AMX *amx, const char *varname, cell *amx_addr
 						auto hdr = (AMX_HEADER*)amx->base;
 						auto data = (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
 						cell addr = *amx_addr = reinterpret_cast<unsigned char*>(buf) - data;
-						auto lock = addr_map[addr].lock();
+						auto &addr_ref = addr_map[amx][addr];
+						auto lock = addr_ref.lock();
 						if(!lock)
 						{
 							lock = std::make_shared<cell>(addr);
-							addr_map[addr] = lock;
+							addr_ref = lock;
 						}
 						if(index)
 						{
@@ -252,15 +254,25 @@ bool lua::interop::amx_num_pubvars(AMX *amx, int *number)
 
 bool lua::interop::amx_get_pubvar_addr(AMX *amx, cell amx_addr, cell **phys_addr)
 {
-	if(phys_addr)
+	if(addr_map.empty() || !phys_addr)
 	{
-		auto it = addr_map.find(amx_addr);
-		if(it != addr_map.end())
+		return false;
+	}
+	auto amx_it = addr_map.find(amx);
+	if(amx_it != addr_map.end())
+	{
+		auto &amx_addrs = amx_it->second;
+		auto it = amx_addrs.find(amx_addr);
+		if(it != amx_addrs.end())
 		{
 			auto lock = it->second.lock();
 			if(!lock)
 			{
-				addr_map.erase(it);
+				amx_addrs.erase(it);
+				if(amx_addrs.empty())
+				{
+					addr_map.erase(amx_it);
+				}
 				return false;
 			}
 
@@ -0,0 +1,406 @@
+#include "router.h"
+#include "native.h"
+#include "public.h"
+#include "lua/interop.h"
+#include "amx/loader.h"
+#include "amx/amxutils.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+// the server stops calling the next filterscripts when these callbacks return 1 (positive) or 0 (negative)
+static int callback_propagation(const std::string &name)
+{
+	if(name == "OnPlayerCommandText" || name == "OnRconCommand" || name == "OnDialogResponse")
+	{
+		return 1;
+	}
+	if(name == "OnPlayerText" || name == "OnPlayerUpdate")
+	{
+		return -1;
+	}
+	return 0;
+}
+
+// all states in the shared mode are reached through a single filterscript
+struct amx_router_info
+{
+	struct route
+	{
+		std::string name;
+		bool valid = false;
+		unsigned int generation = 0;
+		int propagation = 0;
+		std::vector<std::pair<AMX*, int>> targets;
+	};
+
+	AMX *amx = nullptr;
+	std::vector<AMX*> members;
+	std::unordered_set<AMX*> member_set;
+	std::vector<route> routes;
+	std::unordered_map<std::string, int> indices;
+	std::string key;
+	// members waiting for a continuation, keyed by the cip given to the host
+	std::unordered_map<cell, std::pair<AMX*, cell>> sleeping;
+	cell last_sleep = 0;
+	cell mirrored = 0;
+
+	void invalidate()
+	{
+		for(auto &r : routes)
+		{
+			r.valid = false;
+		}
+	}
+
+	// the targets are resolved again only when a public was added or removed in some state
+	void update(route &r)
+	{
+		if(r.valid && r.generation == lua::interop::public_generation())
+		{
+			return;
+		}
+		r.targets.clear();
+		for(AMX *member : members)
+		{
+			int index;
+			if(amx_FindPublic(member, r.name.c_str(), &index) == AMX_ERR_NONE)
+			{
+				r.targets.emplace_back(member, index);
+			}
+		}
+		r.valid = true;
+		r.generation = lua::interop::public_generation();
+	}
+
+	cell suspend(AMX *member)
+	{
+		do{
+			if(++last_sleep <= 0)
+			{
+				last_sleep = 1;
+			}
+		}while(sleeping.find(last_sleep) != sleeping.end());
+		auto &cont = sleeping[last_sleep];
+		cont.first = member;
+		cont.second = member->cip;
+		return last_sleep;
+	}
+
+	void forget(AMX *member)
+	{
+		for(auto it = sleeping.begin(); it != sleeping.end();)
+		{
+			if(it->second.first == member)
+			{
+				it = sleeping.erase(it);
+			}else{
+				++it;
+			}
+		}
+	}
+
+	route &find(const char *funcname, int &index)
+	{
+		key.assign(funcname);
+		auto it = indices.find(key);
+		if(it != indices.end())
+		{
+			index = it->second;
+		}else{
+			index = (int)routes.size();
+			indices[key] = index;
+			routes.emplace_back();
+			routes.back().name = key;
+			routes.back().propagation = callback_propagation(key);
+		}
+		auto &r = routes[index];
+		update(r);
+		return r;
+	}
+};
+
+// the size of the router heap, reserved at the start of the data section of every member
+static const int32_t router_heapspace = 8192;
+
+static bool shared_mode = false;
+static std::unique_ptr<amx_router_info> router;
+
+// a member may be closed while it is running, so it is freed on the next tick once no call is using it
+static std::vector<AMX*> retired;
+static std::unordered_map<AMX*, int> running;
+
+static void retire(AMX *amx)
+{
+	amx->hea = amx->hlw;
+	amx->stk = amx->stp;
+	amx->paramcount = 0;
+	retired.push_back(amx);
+}
+
+static void release(AMX *amx)
+{
+	auto it = running.find(amx);
+	if(--it->second == 0)
+	{
+		running.erase(it);
+	}
+}
+
+static unsigned char *data(AMX *amx)
+{
+	auto hdr = (AMX_HEADER*)amx->base;
+	return (amx->data != NULL) ? amx->data : amx->base + (int)hdr->dat;
+}
+
+void lua::interop::router_setshared(bool shared)
+{
+	shared_mode = shared;
+}
+
+bool lua::interop::router_shared()
+{
+	return shared_mode;
+}
+
+AMX *lua::interop::router_attach(std::function<void(AMX*, void*)> &&init)
+{
+	if(!router)
+	{
+		std::unique_ptr<amx_router_info> info(new amx_router_info());
+		auto ptr = info.get();
+		if(!amx::LoadNew("?luafs_shared", router_heapspace, sNAMEMAX, [=](AMX *amx, void*)
+		{
+			ptr->amx = amx;
+		}))
+		{
+			return nullptr;
+		}
+		router = std::move(info);
+	}
+	AMX *router_amx = router->amx;
+	AMX *amx = amx::LoadPrivate(router_heapspace, 8192, sNAMEMAX, [&](AMX *amx, void *program)
+	{
+		// the natives are only registered in the filterscript
+		amx_copy_natives(router_amx, amx);
+		init(amx, program);
+	});
+	if(amx)
+	{
+		router->members.push_back(amx);
+		router->member_set.insert(amx);
+		router->invalidate();
+	}
+	return amx;
+}
+
+void lua::interop::router_detach(AMX *amx)
+{
+	if(router && router->member_set.erase(amx))
+	{
+		auto &members = router->members;
+		members.erase(std::find(members.begin(), members.end(), amx));
+		router->forget(amx);
+		router->invalidate();
+	}
+	amx_unregister_natives(amx);
+	amx::RemoveHandle(amx);
+	retire(amx);
+}
+
+bool lua::interop::router_unload(AMX *amx)
+{
+	if(!router || router->amx != amx)
+	{
+		return false;
+	}
+	auto members = std::move(router->members);
+	router.reset();
+	for(AMX *member : members)
+	{
+		amx_unload(member);
+		amx::RemoveHandle(member);
+		retire(member);
+	}
+	return true;
+}
+
+void lua::interop::router_tick()
+{
+	// continuations of retired members were already forgotten, so only running calls can refer to them
+	auto end = std::remove_if(retired.begin(), retired.end(), [](AMX *amx)
+	{
+		if(running.find(amx) != running.end())
+		{
+			return false;
+		}
+		amx::UnloadPrivate(amx);
+		return true;
+	});
+	retired.erase(end, retired.end());
+}
+
+void lua::interop::router_close()
+{
+	for(AMX *amx : retired)
+	{
+		amx::UnloadPrivate(amx);
+	}
+	retired.clear();
+}
+
+bool lua::interop::router_find_public(AMX *amx, const char *funcname, int *index, int &error)
+{
+	if(!index || !router || router->amx != amx)
+	{
+		return false;
+	}
+	auto &r = router->find(funcname, *index);
+	error = r.targets.empty() ? AMX_ERR_INDEX : AMX_ERR_NONE;
+	return true;
+}
+
+bool lua::interop::router_get_public(AMX *amx, int index, char *funcname)
+{
+	if(!funcname || !router || router->amx != amx || index < 0 || (size_t)index >= router->routes.size())
+	{
+		return false;
+	}
+	std::strcpy(funcname, router->routes[index].name.c_str());
+	return true;
+}
+
+bool lua::interop::router_num_publics(AMX *amx, int *number)
+{
+	if(!number || !router || router->amx != amx)
+	{
+		return false;
+	}
+	*number = (int)router->routes.size();
+	return true;
+}
+
+static void suspend(AMX *amx, AMX *member)
+{
+	amx->pri = member->pri;
+	amx->alt = member->alt;
+	amx->cip = router ? router->suspend(member) : 0;
+}
+
+static int exec_member(AMX *amx, AMX *member, cell *retval, int index, int paramcount)
+{
+	// the router heap is mirrored below the own heap of the members, so the addresses in the arguments stay valid
+	// and a member that is already running keeps its heap; only the part allocated since the outer call is copied
+	cell from = router->mirrored, to = amx->hea;
+	auto src = data(amx);
+	auto dst = data(member);
+	if(to > from)
+	{
+		std::memcpy(dst + from, src + from, to - from);
+	}
+	cell hea = member->hea, stk = member->stk;
+	member->stk -= paramcount * sizeof(cell);
+	std::memcpy(dst + member->stk, src + amx->stk, paramcount * sizeof(cell));
+	member->paramcount = paramcount;
+
+	router->mirrored = to;
+	running[member]++;
+	int error = amx_Exec(member, retval, index);
+	release(member);
+	if(router)
+	{
+		router->mirrored = from;
+	}
+
+	if(to > from)
+	{
+		std::memcpy(src + from, dst + from, to - from);
+	}
+	if(error == AMX_ERR_SLEEP)
+	{
+		suspend(amx, member);
+	}else{
+		member->hea = hea;
+		member->stk = stk;
+	}
+	return error;
+}
+
+bool lua::interop::router_exec(AMX *amx, cell *retval, int index, int &result)
+{
+	if(!router || router->amx != amx)
+	{
+		return false;
+	}
+	if(index == AMX_EXEC_CONT)
+	{
+		auto it = router->sleeping.find(amx->cip);
+		if(it == router->sleeping.end())
+		{
+			result = amx->error = AMX_ERR_INDEX;
+			return true;
+		}
+		AMX *member = it->second.first;
+		member->cip = it->second.second;
+		router->sleeping.erase(it);
+		member->pri = amx->pri;
+		member->alt = amx->alt;
+		running[member]++;
+		result = amx_Exec(member, retval, AMX_EXEC_CONT);
+		release(member);
+		if(result == AMX_ERR_SLEEP)
+		{
+			suspend(amx, member);
+		}
+		amx->error = result;
+		return true;
+	}
+
+	int paramcount = amx->paramcount;
+	amx->paramcount = 0;
+	result = AMX_ERR_INDEX;
+	if(index >= 0 && (size_t)index < router->routes.size())
+	{
+		auto &r = router->routes[index];
+		router->update(r);
+		// the list may change when a callback modifies the publics
+		auto targets = r.targets;
+		int propagation = r.propagation;
+		for(const auto &target : targets)
+		{
+			if(!router || router->member_set.find(target.first) == router->member_set.end())
+			{
+				continue;
+			}
+			cell value = 0;
+			int error = exec_member(amx, target.first, &value, target.second, paramcount);
+			if(error == AMX_ERR_INDEX)
+			{
+				// the public was removed since the targets were resolved
+				continue;
+			}
+			result = error;
+			if(retval)
+			{
+				*retval = value;
+			}
+			if(result == AMX_ERR_SLEEP)
+			{
+				break;
+			}
+			// the members are chained like separate filterscripts
+			if((propagation > 0 && value) || (propagation < 0 && !value))
+			{
+				break;
+			}
+		}
+	}
+	amx->stk += paramcount * sizeof(cell);
+	amx->error = result;
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef ROUTER_H_INCLUDED
+#define ROUTER_H_INCLUDED
+
+#include "lua/lualibs.h"
+#include "sdk/amx/amx.h"
+#include <functional>
+
+namespace lua
+{
+	namespace interop
+	{
+		void router_setshared(bool shared);
+		bool router_shared();
+		AMX *router_attach(std::function<void(AMX*, void*)> &&init);
+		void router_detach(AMX *amx);
+		bool router_unload(AMX *amx);
+		void router_tick();
+		void router_close();
+		bool router_find_public(AMX *amx, const char *funcname, int *index, int &error);
+		bool router_get_public(AMX *amx, int index, char *funcname);
+		bool router_num_publics(AMX *amx, int *number);
+		bool router_exec(AMX *amx, cell *retval, int index, int &result);
+	}
+}
+
+#endif
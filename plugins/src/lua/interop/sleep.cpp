@@ -30,17 +30,10 @@ int sleep(lua_State *L)
 				case LUA_OK:
 					return 1;
 				default:
-					if(lua_istable(L, -1))
+					if(lua::tosleep(L, -1))
 					{
-						if(lua_getfield(L, -1, "__amxerr") == LUA_TNUMBER)
-						{
-							if(lua_tointeger(L, -1) == AMX_ERR_SLEEP)
-							{
-								lua_pushvalue(L, 1);
-								lua_setfield(L, -3, "__cont");
-							}
-						}
-						lua_pop(L, 1);
+						lua_pushvalue(L, 1);
+						lua_setuservalue(L, -2);
 					}
 					return lua_error(L);
 			}
@@ -60,15 +53,24 @@ void lua::interop::init_sleep(lua_State *L, AMX *amx)
 
 void lua::interop::handle_sleep(lua_State *L, AMX *amx, int contlist)
 {
-	if(lua_getfield(L, -1, "__retval") == LUA_TLIGHTUSERDATA)
+	auto status = lua::tosleep(L, -1);
+	if(!status)
 	{
-		amx->pri = reinterpret_cast<cell>(lua_touserdata(L, -1));
+		return;
 	}
-	lua_pop(L, 1);
+	if(status->hasretval)
+	{
+		amx->pri = status->retval;
+	}
+	status->hasretval = false;
+	status->busy = false;
 
 	if(lua_rawgeti(L, LUA_REGISTRYINDEX, contlist) == LUA_TTABLE)
 	{
-		if(lua_getfield(L, -2, "__cont") == LUA_TFUNCTION)
+		lua_getuservalue(L, -2);
+		lua_pushnil(L);
+		lua_setuservalue(L, -4);
+		if(lua_isfunction(L, -1))
 		{
 			lua_createtable(L, 2, 0);
 			lua_insert(L, -2);
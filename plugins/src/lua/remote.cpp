@@ -1,8 +1,13 @@
 #include "remote.h"
+#include "serial.h"
 #include "lua_utils.h"
+#include "lua_api.h"
 
 #include <unordered_map>
 #include <memory>
+#include <deque>
+#include <vector>
+#include <string>
 
 struct lua_registered_ref
 {
@@ -25,6 +30,13 @@ struct lua_ref_info
 
 	bool marshal(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, bool noproxy = false);
 
+	bool copy(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, int maxdepth, lua_Integer maxsize);
+
+private:
+	bool copy(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, int seen, int depth, lua_Integer &size);
+
+public:
+
 	bool gettable()
 	{
 		if(lua_rawgeti(L, LUA_REGISTRYINDEX, ptrtable) == LUA_TTABLE)
@@ -62,6 +74,62 @@ bool isproxy(lua_State *L, int idx)
 	return false;
 }
 
+static const char PROXYCACHEKEY = 0;
+
+static const int COPY_MAXDEPTH = 64;
+static const lua_Integer COPY_MAXSIZE = 65536;
+
+struct lua_copy_marker
+{
+	int maxdepth;
+	lua_Integer maxsize;
+};
+
+static const char COPYMTKEY = 0;
+
+namespace lua
+{
+	template <>
+	struct mt_ctor<lua_copy_marker>
+	{
+		bool operator()(lua_State *L)
+		{
+			if(lua_rawgetp(L, LUA_REGISTRYINDEX, &COPYMTKEY) == LUA_TTABLE)
+			{
+				return true;
+			}
+			lua_pop(L, 1);
+
+			lua_createtable(L, 0, 2);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &COPYMTKEY);
+
+			lua::pushliteral(L, "copy");
+			lua_setfield(L, -2, "__name");
+			lua_pushboolean(L, false);
+			lua_setfield(L, -2, "__metatable");
+			return true;
+		}
+	};
+}
+
+static lua_copy_marker *tocopymarker(lua_State *L, int idx)
+{
+	if(lua_type(L, idx) != LUA_TUSERDATA)
+	{
+		return nullptr;
+	}
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &COPYMTKEY);
+	auto data = lua::testudata(L, idx, -1);
+	lua_pop(L, 1);
+	return reinterpret_cast<lua_copy_marker*>(data);
+}
+
+struct lua_foreign_reference;
+
+static bool pushcachedproxy(lua_State *L, const void *ptr, const lua_ref_info *remote);
+static void cacheproxy(lua_State *L, const void *ptr);
+
 struct lua_foreign_reference
 {
 	int obj = 0;
@@ -116,7 +184,8 @@ struct lua_foreign_reference
 	{
 		if(auto remote = connect(from))
 		{
-			return remote->marshal(from, to, marshaller, noproxy);
+			// the original object is now on the stack of its own state
+			return remote->marshal(remote->L, to, marshaller, noproxy);
 		}
 		return false;
 	}
@@ -394,6 +463,8 @@ struct lua_foreign_reference
 		return luaL_error(L, "the proxy is dead");
 	}
 
+	int pull(lua_State *L, int idx, int maxdepth, lua_Integer maxsize);
+
 	template <int (lua_foreign_reference::*Method)(lua_State *L)>
 	static int op(lua_State *L)
 	{
@@ -485,6 +556,49 @@ namespace lua
 	};
 }
 
+// the same remote object is always represented by the same proxy while it is alive
+static bool pushcachedproxy(lua_State *L, const void *ptr, const lua_ref_info *remote)
+{
+	if(!lua_checkstack(L, 3))
+	{
+		return false;
+	}
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &PROXYCACHEKEY) == LUA_TTABLE)
+	{
+		if(lua_rawgetp(L, -1, ptr) == LUA_TUSERDATA)
+		{
+			auto &ref = lua::touserdata<lua_foreign_reference>(L, -1);
+			// the address could be reused after the original state was closed
+			if(ref.obj && ref.remote_weak.lock().get() == remote)
+			{
+				lua_remove(L, -2);
+				return true;
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return false;
+}
+
+static void cacheproxy(lua_State *L, const void *ptr)
+{
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &PROXYCACHEKEY) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua::pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &PROXYCACHEKEY);
+	}
+	lua_pushvalue(L, -2);
+	lua_rawsetp(L, -2, ptr);
+	lua_pop(L, 1);
+}
+
 bool lua_ref_info::marshal(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, bool noproxy)
 {
 	if(from == to)
@@ -545,6 +659,17 @@ bool lua_ref_info::marshal(lua_State *from, lua_State *to, const std::shared_ptr
 		}
 		case LUA_TUSERDATA:
 		{
+			if(auto marker = tocopymarker(from, top))
+			{
+				lua_getuservalue(from, top);
+				if(copy(from, to, marshaller, marker->maxdepth, marker->maxsize))
+				{
+					lua_remove(from, top);
+					break;
+				}
+				// over the limits, passed as a proxy
+				lua_pop(from, 1);
+			}
 			if(isproxy(from, top))
 			{
 				auto &ref = lua::touserdata<lua_foreign_reference>(from, top);
@@ -563,11 +688,18 @@ bool lua_ref_info::marshal(lua_State *from, lua_State *to, const std::shared_ptr
 				lua_remove(from, t);
 				return false;
 			}
+			const void *ptr = lua_topointer(from, top);
+			if(pushcachedproxy(to, ptr, this))
+			{
+				lua_remove(from, top);
+				break;
+			}
 			int obj = luaL_ref(from, t);
 			auto &ref = lua::newuserdata<lua_foreign_reference>(to);
 			ref.obj = obj;
 			ref.source = marshaller;
 			ref.remote_weak = getself();
+			cacheproxy(to, ptr);
 			break;
 		}
 	}
@@ -575,6 +707,156 @@ bool lua_ref_info::marshal(lua_State *from, lua_State *to, const std::shared_ptr
 	return true;
 }
 
+bool lua_ref_info::copy(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, int maxdepth, lua_Integer maxsize)
+{
+	if(!lua_checkstack(to, 2))
+	{
+		return false;
+	}
+	int from_top = lua_gettop(from) - 1;
+	int to_top = lua_gettop(to);
+	// copies of already visited tables
+	lua_newtable(to);
+	int seen = lua_absindex(to, -1);
+	if(!copy(from, to, marshaller, seen, maxdepth, maxsize))
+	{
+		lua_settop(from, from_top + 1);
+		lua_settop(to, to_top);
+		return false;
+	}
+	lua_remove(to, seen);
+	return true;
+}
+
+bool lua_ref_info::copy(lua_State *from, lua_State *to, const std::shared_ptr<lua_ref_info> &marshaller, int seen, int depth, lua_Integer &size)
+{
+	int obj = lua_absindex(from, -1);
+	if(lua_type(from, obj) != LUA_TTABLE)
+	{
+		return marshal(from, to, marshaller);
+	}
+	if(lua_getmetatable(from, obj))
+	{
+		// only plain tables are copied
+		lua_pop(from, 1);
+		return marshal(from, to, marshaller);
+	}
+	if(!lua_checkstack(from, 4) || !lua_checkstack(to, 4))
+	{
+		return false;
+	}
+	const void *ptr = lua_topointer(from, obj);
+	if(lua_rawgetp(to, seen, ptr) == LUA_TTABLE)
+	{
+		lua_pop(from, 1);
+		return true;
+	}
+	lua_pop(to, 1);
+	if(depth <= 0)
+	{
+		return false;
+	}
+	lua_createtable(to, (int)lua_rawlen(from, obj), 0);
+	lua_pushvalue(to, -1);
+	lua_rawsetp(to, seen, ptr);
+	int table = lua_gettop(to);
+
+	lua_pushnil(from);
+	while(lua_next(from, obj))
+	{
+		if(--size < 0)
+		{
+			return false;
+		}
+		lua_pushvalue(from, -2);
+		if(!copy(from, to, marshaller, seen, depth - 1, size))
+		{
+			return false;
+		}
+		if(!copy(from, to, marshaller, seen, depth - 1, size))
+		{
+			return false;
+		}
+		if(lua_isnil(to, -2))
+		{
+			lua_pop(to, 2);
+		}else{
+			lua_rawset(to, table);
+		}
+	}
+	lua_pop(from, 1);
+	return true;
+}
+
+static int copycall(lua_State *L)
+{
+	int nargs = lua_gettop(L);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	lua_call(L, nargs, LUA_MULTRET);
+	int maxdepth = (int)lua_tointeger(L, lua_upvalueindex(2));
+	lua_Integer maxsize = lua_tointeger(L, lua_upvalueindex(3));
+	int nresults = lua_gettop(L);
+	for(int i = 1; i <= nresults; i++)
+	{
+		if(isproxy(L, i))
+		{
+			lua::touserdata<lua_foreign_reference>(L, i).pull(L, i, maxdepth, maxsize);
+			lua_replace(L, i);
+		}
+	}
+	return nresults;
+}
+
+int lua_foreign_reference::pull(lua_State *L, int idx, int maxdepth, lua_Integer maxsize)
+{
+	idx = lua_absindex(L, idx);
+	if(auto remote = connect(L))
+	{
+		auto L2 = remote->L;
+		lua::stackguard guard(L2, -1);
+		if(lua_type(L2, -1) == LUA_TFUNCTION)
+		{
+			lua_pop(L2, 1);
+			// the results of the function will be copied
+			lua_pushvalue(L, idx);
+			lua_pushinteger(L, maxdepth);
+			lua_pushinteger(L, maxsize);
+			lua_pushcclosure(L, copycall, 3);
+			return 1;
+		}
+		if(!remote->copy(L2, L, source, maxdepth, maxsize))
+		{
+			lua_pop(L2, 1);
+			return luaL_error(L, "the value exceeds the copy limits");
+		}
+		return 1;
+	}
+	return luaL_error(L, "the proxy is dead");
+}
+
+static int copy(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	int maxdepth = (int)luaL_optinteger(L, 2, COPY_MAXDEPTH);
+	lua_Integer maxsize = luaL_optinteger(L, 3, COPY_MAXSIZE);
+	lua_settop(L, 1);
+	if(isproxy(L, 1))
+	{
+		return lua::touserdata<lua_foreign_reference>(L, 1).pull(L, 1, maxdepth, maxsize);
+	}
+	if(lua_istable(L, 1))
+	{
+		// copied when passed to another state
+		auto &marker = lua::newuserdata<lua_copy_marker>(L);
+		marker.maxdepth = maxdepth;
+		marker.maxsize = maxsize;
+		lua_pushvalue(L, 1);
+		lua_setuservalue(L, -2);
+	}
+	return 1;
+}
+
 int _register(lua_State *L)
 {
 	auto ptr = lua_topointer(L, 1);
@@ -681,6 +963,425 @@ int unregister(lua_State *L)
 	return 1;
 }
 
+struct lua_channel_message
+{
+	int count;
+	std::string data;
+};
+
+struct lua_channel_info
+{
+	lua_State *L;
+	lua_Integer id;
+	size_t limit;
+	std::deque<lua_channel_message> queue;
+	lua_Integer whead = 1;
+	lua_Integer wtail = 1;
+	int ref = LUA_NOREF;
+	bool listening = false;
+	bool scheduled = false;
+	bool closed = false;
+
+	lua_channel_info(lua_State *L, lua_Integer id, size_t limit) : L(L), id(id), limit(limit)
+	{
+
+	}
+
+	~lua_channel_info()
+	{
+		close();
+	}
+
+	void close();
+
+	// the channel object is kept alive while a handler or a waiter could receive messages from it
+	void hold(lua_State *L, int idx)
+	{
+		if(ref == LUA_NOREF)
+		{
+			lua_pushvalue(L, idx);
+			ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		}
+	}
+
+	void release()
+	{
+		if(ref != LUA_NOREF && !listening && whead == wtail)
+		{
+			luaL_unref(L, LUA_REGISTRYINDEX, ref);
+			ref = LUA_NOREF;
+		}
+	}
+
+	void schedule(const std::shared_ptr<lua_channel_info> &self);
+
+	bool send(lua_State *from, int first, int last, const std::shared_ptr<lua_channel_info> &self)
+	{
+		if(closed || (limit > 0 && queue.size() >= limit))
+		{
+			return false;
+		}
+		lua_channel_message msg;
+		msg.count = last - first + 1;
+		for(int i = first; i <= last; i++)
+		{
+			lua::serial::encode(from, i, msg.data);
+		}
+		queue.push_back(std::move(msg));
+		schedule(self);
+		return true;
+	}
+
+	int receive(lua_State *L)
+	{
+		auto msg = std::move(queue.front());
+		queue.pop_front();
+		luaL_checkstack(L, msg.count + 2, nullptr);
+		size_t pos = 0;
+		for(int i = 0; i < msg.count; i++)
+		{
+			lua::serial::decode(L, msg.data.data(), msg.data.size(), pos);
+		}
+		return msg.count;
+	}
+
+	void deliver(const std::shared_ptr<lua_channel_info> &self);
+};
+
+static std::unordered_map<lua_Integer, std::weak_ptr<lua_channel_info>> channel_map;
+static std::vector<std::weak_ptr<lua_channel_info>> pending_channels;
+static lua_Integer channel_next_id = 1;
+
+void lua_channel_info::close()
+{
+	if(!closed)
+	{
+		closed = true;
+		channel_map.erase(id);
+	}
+}
+
+void lua_channel_info::schedule(const std::shared_ptr<lua_channel_info> &self)
+{
+	if(!scheduled)
+	{
+		scheduled = true;
+		pending_channels.push_back(self);
+	}
+}
+
+static const char CHANNELMTKEY = 0;
+static const char CHANNELSKEY = 0;
+
+static std::shared_ptr<lua_channel_info> *tochannel(lua_State *L, int idx)
+{
+	if(lua_type(L, idx) != LUA_TUSERDATA)
+	{
+		return nullptr;
+	}
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &CHANNELMTKEY);
+	auto data = lua::testudata(L, idx, -1);
+	lua_pop(L, 1);
+	return reinterpret_cast<std::shared_ptr<lua_channel_info>*>(data);
+}
+
+static std::shared_ptr<lua_channel_info> &checkchannel(lua_State *L, int idx)
+{
+	auto info = tochannel(L, idx);
+	if(!info)
+	{
+		lua::argerrortype(L, idx, "channel");
+	}
+	return *info;
+}
+
+void lua_channel_info::deliver(const std::shared_ptr<lua_channel_info> &self)
+{
+	lua::stackguard guard(L);
+	luaL_checkstack(L, 4, nullptr);
+	// the channel object is kept in a weak table, so it is found only while it is reachable
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &CHANNELSKEY) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		return;
+	}
+	if(lua_rawgetp(L, -1, this) != LUA_TUSERDATA)
+	{
+		lua_pop(L, 2);
+		return;
+	}
+	lua_getuservalue(L, -1);
+	int uservalue = lua_absindex(L, -1);
+
+	// only the messages present now are delivered, those sent by the handlers wait for the next tick
+	size_t count = queue.size();
+	while(count > 0 && !queue.empty())
+	{
+		bool batch = false;
+		int nargs = 0;
+		if(whead < wtail)
+		{
+			lua_rawgeti(L, uservalue, whead);
+			lua_pushnil(L);
+			lua_rawseti(L, uservalue, whead);
+			whead++;
+			lua_pushboolean(L, true);
+			nargs++;
+		}else if(lua_getfield(L, uservalue, "handler") != LUA_TNIL)
+		{
+			lua_getfield(L, uservalue, "batch");
+			batch = !!lua_toboolean(L, -1);
+			lua_pop(L, 1);
+		}else{
+			lua_pop(L, 1);
+			break;
+		}
+		if(batch)
+		{
+			lua_createtable(L, static_cast<int>(count), 0);
+			for(size_t i = 1; i <= count; i++)
+			{
+				int num = receive(L);
+				lua_createtable(L, num, 1);
+				lua_insert(L, -num - 1);
+				for(int j = num; j >= 1; j--)
+				{
+					lua_rawseti(L, -j - 1, j);
+				}
+				lua_pushinteger(L, num);
+				lua_setfield(L, -2, "n");
+				lua_rawseti(L, -2, i);
+			}
+			count = 0;
+			nargs = 1;
+		}else{
+			nargs += receive(L);
+			count--;
+		}
+		int err = lua_pcall(L, nargs, 0, 0);
+		if(err != LUA_OK)
+		{
+			lua::report_error(L, err);
+			lua_pop(L, 1);
+		}
+	}
+	if(closed && queue.empty())
+	{
+		// the waiters are told that no more messages will come
+		while(whead < wtail)
+		{
+			lua_rawgeti(L, uservalue, whead);
+			lua_pushnil(L);
+			lua_rawseti(L, uservalue, whead);
+			whead++;
+			lua_pushboolean(L, false);
+			int err = lua_pcall(L, 1, 0, 0);
+			if(err != LUA_OK)
+			{
+				lua::report_error(L, err);
+				lua_pop(L, 1);
+			}
+		}
+		lua_pushnil(L);
+		lua_setfield(L, uservalue, "handler");
+		listening = false;
+	}
+	if(whead == wtail)
+	{
+		whead = wtail = 1;
+	}
+	release();
+	lua_pop(L, 3);
+	if(!queue.empty() && (whead < wtail || count == 0))
+	{
+		schedule(self);
+	}
+}
+
+namespace lua
+{
+	template <>
+	struct mt_ctor<std::shared_ptr<lua_channel_info>>
+	{
+		bool operator()(lua_State *L)
+		{
+			if(lua_rawgetp(L, LUA_REGISTRYINDEX, &CHANNELMTKEY) == LUA_TTABLE)
+			{
+				return true;
+			}
+			lua_pop(L, 1);
+
+			lua_createtable(L, 0, 4);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &CHANNELMTKEY);
+
+			lua::pushliteral(L, "channel");
+			lua_setfield(L, -2, "__name");
+
+			lua_createtable(L, 0, 6);
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				lua_pushinteger(L, info->id);
+				return 1;
+			});
+			lua_setfield(L, -2, "id");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				lua_pushinteger(L, static_cast<lua_Integer>(info->queue.size()));
+				return 1;
+			});
+			lua_setfield(L, -2, "count");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				if(info->queue.empty())
+				{
+					lua_pushboolean(L, false);
+					return 1;
+				}
+				lua_pushboolean(L, true);
+				return 1 + info->receive(L);
+			});
+			lua_setfield(L, -2, "receive");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				if(!info->queue.empty())
+				{
+					lua_pushboolean(L, true);
+					return 1 + info->receive(L);
+				}
+				if(info->closed)
+				{
+					lua_pushboolean(L, false);
+					return 1;
+				}
+				if(!lua_isyieldable(L)) return luaL_error(L, "must be executed inside 'async'");
+				// the continuation is registered as a waiter and called with the next message
+				lua_settop(L, 1);
+				lua_pushcfunction(L, [](lua_State *L)
+				{
+					luaL_checktype(L, 1, LUA_TFUNCTION);
+					auto &info = checkchannel(L, 2);
+					lua_getuservalue(L, 2);
+					lua_pushvalue(L, 1);
+					lua_rawseti(L, -2, info->wtail++);
+					info->hold(L, 2);
+					if(!info->queue.empty() || info->closed)
+					{
+						info->schedule(info);
+					}
+					return 0;
+				});
+				lua_insert(L, 1);
+				return lua::tailyield(L, 2);
+			});
+			lua_setfield(L, -2, "wait");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				if(!lua_isnoneornil(L, 2))
+				{
+					luaL_checktype(L, 2, LUA_TFUNCTION);
+				}
+				lua_settop(L, 3);
+				lua_getuservalue(L, 1);
+				lua_pushvalue(L, 2);
+				lua_setfield(L, -2, "handler");
+				lua_pushboolean(L, lua_toboolean(L, 3));
+				lua_setfield(L, -2, "batch");
+				info->listening = !lua_isnil(L, 2) && !info->closed;
+				if(info->listening)
+				{
+					info->hold(L, 1);
+				}else{
+					info->release();
+				}
+				if(!info->queue.empty())
+				{
+					info->schedule(info);
+				}
+				return 0;
+			});
+			lua_setfield(L, -2, "listen");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checkchannel(L, 1);
+				info->close();
+				// the remaining messages are still delivered, then the waiters are resumed and the channel is released
+				info->schedule(info);
+				return 0;
+			});
+			lua_setfield(L, -2, "close");
+			lua_setfield(L, -2, "__index");
+
+			return true;
+		}
+	};
+}
+
+static int channel(lua_State *L)
+{
+	lua_Integer limit = luaL_optinteger(L, 1, 0);
+	if(limit < 0)
+	{
+		return luaL_argerror(L, 1, "out of range");
+	}
+	auto info = std::make_shared<lua_channel_info>(lua::mainthread(L), channel_next_id++, static_cast<size_t>(limit));
+	channel_map[info->id] = info;
+	auto ptr = info.get();
+	lua::pushuserdata(L, std::move(info));
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &CHANNELSKEY) != LUA_TTABLE)
+	{
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_createtable(L, 0, 1);
+		lua::pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &CHANNELSKEY);
+	}
+	lua_pushvalue(L, -2);
+	lua_rawsetp(L, -2, ptr);
+	lua_pop(L, 1);
+	return 1;
+}
+
+static int send(lua_State *L)
+{
+	std::shared_ptr<lua_channel_info> info;
+	if(lua_isinteger(L, 1))
+	{
+		auto it = channel_map.find(lua_tointeger(L, 1));
+		if(it != channel_map.end())
+		{
+			info = it->second.lock();
+		}
+	}else if(isproxy(L, 1))
+	{
+		// a channel passed to another state arrives as a proxy
+		auto &proxy = lua::touserdata<lua_foreign_reference>(L, 1);
+		if(auto remote = proxy.connect(L))
+		{
+			if(auto ptr = tochannel(remote->L, -1))
+			{
+				info = *ptr;
+			}
+			lua_pop(remote->L, 1);
+		}
+	}else{
+		info = checkchannel(L, 1);
+	}
+	lua_pushboolean(L, info && info->send(L, 2, lua_gettop(L), info));
+	return 1;
+}
+
 int lua::remote::loader(lua_State *L)
 {
 	lua_createtable(L, 0, 2);
@@ -704,6 +1405,9 @@ int lua::remote::loader(lua_State *L)
 	lua_pushcfunction(L, unregister);
 	lua_setfield(L, table, "unregister");
 
+	lua_pushcfunction(L, copy);
+	lua_setfield(L, table, "copy");
+
 	lua_pushcfunction(L, [](lua_State *L)
 	{
 		lua_pushboolean(L, isproxy(L, 1));
@@ -726,10 +1430,36 @@ int lua::remote::loader(lua_State *L)
 	});
 	lua_setfield(L, table, "isalive");
 
+	lua_pushcfunction(L, channel);
+	lua_setfield(L, table, "channel");
+
+	lua_pushcfunction(L, send);
+	lua_setfield(L, table, "send");
+
 	return 1;
 }
 
+void lua::remote::tick()
+{
+	if(pending_channels.empty())
+	{
+		return;
+	}
+	std::vector<std::weak_ptr<lua_channel_info>> channels;
+	channels.swap(pending_channels);
+	for(auto &weak : channels)
+	{
+		if(auto info = weak.lock())
+		{
+			info->scheduled = false;
+			info->deliver(info);
+		}
+	}
+}
+
 void lua::remote::close()
 {
 	ref_map.clear();
+	pending_channels.clear();
+	channel_map.clear();
 }
@@ -9,6 +9,7 @@ namespace lua
 	{
 		int loader(lua_State *L);
 		void close();
+		void tick();
 	}
 }
 
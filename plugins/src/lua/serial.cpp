@@ -0,0 +1,577 @@
+#include "serial.h"
+#include "lua_utils.h"
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+
+// tags of the encoded values; strings up to 63 bytes and integers up to 127 are stored in the tag itself
+enum serial_tag : unsigned char
+{
+	TAG_NIL = 0x00,
+	TAG_FALSE = 0x01,
+	TAG_TRUE = 0x02,
+	TAG_INTEGER = 0x03,
+	TAG_FLOAT = 0x04,
+	TAG_STRING = 0x05,
+	TAG_TABLE = 0x06,
+	TAG_SHORTSTRING = 0x40,
+	TAG_SMALLINT = 0x80,
+};
+
+static const int SERIAL_MAXDEPTH = 200;
+
+struct serial_writer
+{
+	std::string *out;
+	unsigned char *buf;
+	size_t capacity;
+	size_t size = 0;
+
+	// writes past the capacity are dropped but still counted
+	serial_writer(std::string *out) : out(out), buf(nullptr), capacity(0)
+	{
+
+	}
+
+	serial_writer(unsigned char *buf, size_t capacity) : out(nullptr), buf(buf), capacity(capacity)
+	{
+
+	}
+
+	void write(const void *data, size_t len)
+	{
+		if(out)
+		{
+			out->append(reinterpret_cast<const char*>(data), len);
+		}else if(size + len <= capacity)
+		{
+			std::memcpy(buf + size, data, len);
+		}
+		size += len;
+	}
+
+	void byte(unsigned char value)
+	{
+		write(&value, 1);
+	}
+
+	void varint(uint64_t value)
+	{
+		unsigned char data[10];
+		size_t len = 0;
+		while(value >= 0x80)
+		{
+			data[len++] = static_cast<unsigned char>(value | 0x80);
+			value >>= 7;
+		}
+		data[len++] = static_cast<unsigned char>(value);
+		write(data, len);
+	}
+
+	void number(double value)
+	{
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		unsigned char data[8];
+		for(int i = 0; i < 8; i++)
+		{
+			data[i] = static_cast<unsigned char>(bits >> (i * 8));
+		}
+		write(data, 8);
+	}
+};
+
+struct serial_reader
+{
+	const unsigned char *pos;
+	const unsigned char *end;
+
+	size_t left() const
+	{
+		return end - pos;
+	}
+
+	bool byte(unsigned char &value)
+	{
+		if(pos == end) return false;
+		value = *pos++;
+		return true;
+	}
+
+	bool varint(lua_State *L, uint64_t &value)
+	{
+		value = 0;
+		for(int shift = 0; shift < 64; shift += 7)
+		{
+			unsigned char b;
+			if(!byte(b)) return false;
+			value |= static_cast<uint64_t>(b & 0x7F) << shift;
+			if(!(b & 0x80)) return true;
+		}
+		luaL_error(L, "malformed data (invalid varint)");
+		return false;
+	}
+
+	bool number(double &value)
+	{
+		if(left() < 8) return false;
+		uint64_t bits = 0;
+		for(int i = 0; i < 8; i++)
+		{
+			bits |= static_cast<uint64_t>(pos[i]) << (i * 8);
+		}
+		pos += 8;
+		std::memcpy(&value, &bits, sizeof(value));
+		return true;
+	}
+};
+
+static void encode(lua_State *L, int idx, serial_writer &w, int seen, int depth)
+{
+	switch(lua_type(L, idx))
+	{
+		case LUA_TNIL:
+			w.byte(TAG_NIL);
+			break;
+		case LUA_TBOOLEAN:
+			w.byte(lua_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE);
+			break;
+		case LUA_TNUMBER:
+			if(lua_isinteger(L, idx))
+			{
+				lua_Integer value = lua_tointeger(L, idx);
+				if(value >= 0 && value < 0x80)
+				{
+					w.byte(TAG_SMALLINT | static_cast<unsigned char>(value));
+				}else{
+					auto bits = static_cast<uint64_t>(value);
+					w.byte(TAG_INTEGER);
+					w.varint((bits << 1) ^ (value < 0 ? ~static_cast<uint64_t>(0) : 0));
+				}
+			}else{
+				w.byte(TAG_FLOAT);
+				w.number(static_cast<double>(lua_tonumber(L, idx)));
+			}
+			break;
+		case LUA_TSTRING:
+		{
+			size_t len;
+			auto str = lua_tolstring(L, idx, &len);
+			if(len < 0x40)
+			{
+				w.byte(TAG_SHORTSTRING | static_cast<unsigned char>(len));
+			}else{
+				w.byte(TAG_STRING);
+				w.varint(len);
+			}
+			w.write(str, len);
+			break;
+		}
+		case LUA_TTABLE:
+		{
+			if(depth >= SERIAL_MAXDEPTH)
+			{
+				luaL_error(L, "table nesting too deep");
+			}
+			luaL_checkstack(L, 4, nullptr);
+			lua_pushvalue(L, idx);
+			if(lua_rawget(L, seen) != LUA_TNIL)
+			{
+				luaL_error(L, "cannot serialize a recursive table");
+			}
+			lua_pop(L, 1);
+			lua_pushvalue(L, idx);
+			lua_pushboolean(L, true);
+			lua_rawset(L, seen);
+
+			// the sequence part is stored without keys, everything else as pairs
+			lua_Integer narr = static_cast<lua_Integer>(lua_rawlen(L, idx));
+			uint64_t nhash = 0;
+			lua_pushnil(L);
+			while(lua_next(L, idx))
+			{
+				lua_pop(L, 1);
+				if(!lua_isinteger(L, -1) || lua_tointeger(L, -1) < 1 || lua_tointeger(L, -1) > narr)
+				{
+					nhash++;
+				}
+			}
+
+			w.byte(TAG_TABLE);
+			w.varint(static_cast<uint64_t>(narr));
+			w.varint(nhash);
+			for(lua_Integer i = 1; i <= narr; i++)
+			{
+				lua_rawgeti(L, idx, i);
+				encode(L, lua_absindex(L, -1), w, seen, depth + 1);
+				lua_pop(L, 1);
+			}
+			lua_pushnil(L);
+			while(lua_next(L, idx))
+			{
+				if(lua_isinteger(L, -2) && lua_tointeger(L, -2) >= 1 && lua_tointeger(L, -2) <= narr)
+				{
+					lua_pop(L, 1);
+					continue;
+				}
+				int top = lua_gettop(L);
+				encode(L, top - 1, w, seen, depth + 1);
+				encode(L, top, w, seen, depth + 1);
+				lua_pop(L, 1);
+			}
+
+			// shared subtables are allowed, only cycles are rejected
+			lua_pushvalue(L, idx);
+			lua_pushnil(L);
+			lua_rawset(L, seen);
+			break;
+		}
+		default:
+			luaL_error(L, "cannot serialize a %s value", luaL_typename(L, idx));
+			break;
+	}
+}
+
+static void encode(lua_State *L, int idx, serial_writer &w)
+{
+	idx = lua_absindex(L, idx);
+	lua_newtable(L);
+	encode(L, idx, w, lua_absindex(L, -1), 0);
+	lua_pop(L, 1);
+}
+
+// pushes the decoded value, or returns false if the data ends prematurely (the stack is left to the caller to restore)
+static bool decode(lua_State *L, serial_reader &r, int depth)
+{
+	unsigned char tag;
+	if(!r.byte(tag)) return false;
+	if(tag & TAG_SMALLINT)
+	{
+		lua_pushinteger(L, tag & 0x7F);
+		return true;
+	}
+	if(tag & TAG_SHORTSTRING)
+	{
+		size_t len = tag & 0x3F;
+		if(r.left() < len) return false;
+		lua_pushlstring(L, reinterpret_cast<const char*>(r.pos), len);
+		r.pos += len;
+		return true;
+	}
+	switch(tag)
+	{
+		case TAG_NIL:
+			lua_pushnil(L);
+			return true;
+		case TAG_FALSE:
+			lua_pushboolean(L, false);
+			return true;
+		case TAG_TRUE:
+			lua_pushboolean(L, true);
+			return true;
+		case TAG_INTEGER:
+		{
+			uint64_t bits;
+			if(!r.varint(L, bits)) return false;
+			bits = (bits >> 1) ^ (~(bits & 1) + 1);
+			lua_pushinteger(L, static_cast<lua_Integer>(bits));
+			return true;
+		}
+		case TAG_FLOAT:
+		{
+			double value;
+			if(!r.number(value)) return false;
+			lua_pushnumber(L, static_cast<lua_Number>(value));
+			return true;
+		}
+		case TAG_STRING:
+		{
+			uint64_t len;
+			if(!r.varint(L, len)) return false;
+			if(r.left() < len) return false;
+			lua_pushlstring(L, reinterpret_cast<const char*>(r.pos), static_cast<size_t>(len));
+			r.pos += len;
+			return true;
+		}
+		case TAG_TABLE:
+		{
+			if(depth >= SERIAL_MAXDEPTH)
+			{
+				luaL_error(L, "table nesting too deep");
+			}
+			uint64_t narr, nhash;
+			if(!r.varint(L, narr)) return false;
+			if(!r.varint(L, nhash)) return false;
+			// every value takes at least one byte, so the counts can be checked before allocating
+			if(narr > r.left() || nhash > r.left() / 2 || narr + 2 * nhash > r.left()) return false;
+			luaL_checkstack(L, 4, nullptr);
+			lua_createtable(L, narr > INT_MAX ? INT_MAX : static_cast<int>(narr), nhash > INT_MAX ? INT_MAX : static_cast<int>(nhash));
+			int table = lua_absindex(L, -1);
+			for(uint64_t i = 1; i <= narr; i++)
+			{
+				if(!decode(L, r, depth + 1)) return false;
+				lua_rawseti(L, table, static_cast<lua_Integer>(i));
+			}
+			for(uint64_t i = 0; i < nhash; i++)
+			{
+				if(!decode(L, r, depth + 1)) return false;
+				if(lua_isnil(L, -1))
+				{
+					luaL_error(L, "malformed data (nil table key)");
+				}
+				if(lua_type(L, -1) == LUA_TNUMBER && !lua_isinteger(L, -1) && lua_tonumber(L, -1) != lua_tonumber(L, -1))
+				{
+					luaL_error(L, "malformed data (NaN table key)");
+				}
+				if(!decode(L, r, depth + 1)) return false;
+				lua_rawset(L, table);
+			}
+			return true;
+		}
+		default:
+			luaL_error(L, "malformed data (unknown tag %d)", (int)tag);
+			return false;
+	}
+}
+
+static const unsigned char *checkdata(lua_State *L, int idx, int offidx, size_t &len)
+{
+	if(lua_type(L, idx) == LUA_TSTRING)
+	{
+		auto str = reinterpret_cast<const unsigned char*>(lua_tolstring(L, idx, &len));
+		lua_Integer pos = luaL_optinteger(L, offidx, 1);
+		if(pos < 1 || static_cast<size_t>(pos) > len + 1)
+		{
+			lua::argerror(L, offidx, "position out of range");
+		}
+		len -= static_cast<size_t>(pos - 1);
+		return str + (pos - 1);
+	}
+	bool isconst;
+	auto ptr = reinterpret_cast<const unsigned char*>(lua::tobuffer(L, idx, len, isconst));
+	if(!ptr)
+	{
+		lua::argerrortype(L, idx, "string or buffer type");
+	}
+	ptrdiff_t offset = lua::checkoffset(L, offidx);
+	if(offset < 0 || static_cast<size_t>(offset) > len)
+	{
+		lua::argerror(L, offidx, "offset out of range");
+	}
+	len -= offset;
+	return ptr + offset;
+}
+
+static int encode(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	lua_settop(L, 3);
+	if(lua_isnil(L, 2))
+	{
+		std::string out;
+		serial_writer w(&out);
+		encode(L, 1, w);
+		lua_pushlstring(L, out.data(), out.size());
+		return 1;
+	}
+
+	size_t blen;
+	bool isconst;
+	auto ptr = reinterpret_cast<unsigned char*>(lua::tobuffer(L, 2, blen, isconst));
+	if(!ptr)
+	{
+		return lua::argerrortype(L, 2, "buffer type");
+	}
+	if(isconst)
+	{
+		return lua::argerror(L, 2, "the buffer is read-only");
+	}
+	ptrdiff_t offset = lua::checkoffset(L, 3);
+	if(offset < 0 || static_cast<size_t>(offset) > blen)
+	{
+		return lua::argerror(L, 3, "offset out of range");
+	}
+	serial_writer w(ptr + offset, blen - offset);
+	encode(L, 1, w);
+	if(w.size > w.capacity)
+	{
+		// the buffer is too small and its contents are unspecified; the required size is returned so that a larger one can be provided
+		lua_pushnil(L);
+		lua_pushinteger(L, static_cast<lua_Integer>(w.size));
+		return 2;
+	}
+	lua_pushinteger(L, static_cast<lua_Integer>(w.size));
+	lua_pushlightuserdata(L, reinterpret_cast<void*>(offset + w.size));
+	return 2;
+}
+
+static int size(lua_State *L)
+{
+	luaL_checkany(L, 1);
+	serial_writer w(nullptr, 0);
+	encode(L, 1, w);
+	lua_pushinteger(L, static_cast<lua_Integer>(w.size));
+	return 1;
+}
+
+static int decode(lua_State *L)
+{
+	lua_settop(L, 2);
+	size_t len;
+	auto data = checkdata(L, 1, 2, len);
+	serial_reader r{data, data + len};
+	if(!decode(L, r, 0))
+	{
+		return luaL_error(L, "malformed data (unexpected end)");
+	}
+	if(lua_type(L, 1) == LUA_TSTRING)
+	{
+		lua_pushinteger(L, luaL_optinteger(L, 2, 1) + static_cast<lua_Integer>(r.pos - data));
+	}else{
+		lua_pushlightuserdata(L, reinterpret_cast<void*>(lua::checkoffset(L, 2) + (r.pos - data)));
+	}
+	return 2;
+}
+
+struct serial_decoder
+{
+	std::string data;
+	size_t pos = 0;
+};
+
+static const char DECODERMTKEY = 0;
+
+static serial_decoder &checkdecoder(lua_State *L, int idx)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &DECODERMTKEY);
+	auto data = lua::testudata(L, idx, -1);
+	lua_pop(L, 1);
+	if(!data)
+	{
+		lua::argerrortype(L, idx, "decoder");
+	}
+	return *reinterpret_cast<serial_decoder*>(data);
+}
+
+namespace lua
+{
+	template <>
+	struct mt_ctor<serial_decoder>
+	{
+		bool operator()(lua_State *L)
+		{
+			if(lua_rawgetp(L, LUA_REGISTRYINDEX, &DECODERMTKEY) == LUA_TTABLE)
+			{
+				return true;
+			}
+			lua_pop(L, 1);
+
+			lua_createtable(L, 0, 4);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &DECODERMTKEY);
+
+			lua::pushliteral(L, "decoder");
+			lua_setfield(L, -2, "__name");
+
+			lua_createtable(L, 0, 3);
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &dec = checkdecoder(L, 1);
+				lua_settop(L, 4);
+				size_t len;
+				auto data = checkdata(L, 2, 3, len);
+				if(!lua_isnil(L, 4))
+				{
+					auto limit = luaL_checkinteger(L, 4);
+					if(limit >= 0 && static_cast<size_t>(limit) < len)
+					{
+						len = static_cast<size_t>(limit);
+					}
+				}
+				if(dec.pos > 0 && dec.pos >= dec.data.size() / 2)
+				{
+					dec.data.erase(0, dec.pos);
+					dec.pos = 0;
+				}
+				dec.data.append(reinterpret_cast<const char*>(data), len);
+				return 0;
+			});
+			lua_setfield(L, -2, "feed");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &dec = checkdecoder(L, 1);
+				lua_settop(L, 1);
+				auto data = reinterpret_cast<const unsigned char*>(dec.data.data());
+				serial_reader r;
+				r.pos = data + dec.pos;
+				r.end = data + dec.data.size();
+				lua_pushboolean(L, true);
+				if(!decode(L, r, 0))
+				{
+					// incomplete values are parsed again when more data is fed
+					lua_settop(L, 1);
+					lua_pushboolean(L, false);
+					return 1;
+				}
+				dec.pos = r.pos - data;
+				return 2;
+			});
+			lua_setfield(L, -2, "read");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &dec = checkdecoder(L, 1);
+				lua_pushinteger(L, static_cast<lua_Integer>(dec.data.size() - dec.pos));
+				return 1;
+			});
+			lua_setfield(L, -2, "pending");
+			lua_setfield(L, -2, "__index");
+
+			return true;
+		}
+	};
+}
+
+void lua::serial::encode(lua_State *L, int idx, std::string &out)
+{
+	serial_writer w(&out);
+	::encode(L, idx, w);
+}
+
+bool lua::serial::decode(lua_State *L, const char *data, size_t length, size_t &pos)
+{
+	int top = lua_gettop(L);
+	auto begin = reinterpret_cast<const unsigned char*>(data);
+	serial_reader r{begin + pos, begin + length};
+	if(!::decode(L, r, 0))
+	{
+		lua_settop(L, top);
+		return false;
+	}
+	pos = r.pos - begin;
+	return true;
+}
+
+int lua::serial::loader(lua_State *L)
+{
+	lua_createtable(L, 0, 4);
+
+	lua_pushcfunction(L, ::encode);
+	lua_setfield(L, -2, "encode");
+
+	lua_pushcfunction(L, ::decode);
+	lua_setfield(L, -2, "decode");
+
+	lua_pushcfunction(L, size);
+	lua_setfield(L, -2, "size");
+
+	lua_pushcfunction(L, [](lua_State *L)
+	{
+		lua::newuserdata<serial_decoder>(L);
+		return 1;
+	});
+	lua_setfield(L, -2, "decoder");
+
+	return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef SERIAL_H_INCLUDED
+#define SERIAL_H_INCLUDED
+
+#include "lua/lualibs.h"
+
+#include <string>
+
+namespace lua
+{
+	namespace serial
+	{
+		int loader(lua_State *L);
+		void encode(lua_State *L, int idx, std::string &out);
+		bool decode(lua_State *L, const char *data, size_t length, size_t &pos);
+	}
+}
+
+#endif
@@ -2,62 +2,83 @@
 #include "lua_utils.h"
 #include "lua_api.h"
 
+#include "utils/timer_queue.h"
+
 #include <utility>
 #include <chrono>
-#include <list>
 #include <functional>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 typedef std::function<void()> handler_t;
 
 static int tick_count = 0;
-static std::list<std::pair<int, handler_t>> tick_handlers;
-static std::list<std::pair<std::chrono::steady_clock::time_point, handler_t>> timer_handlers;
+static aux::timer_queue<int, handler_t> tick_handlers;
+static aux::timer_queue<std::chrono::steady_clock::time_point, handler_t> timer_handlers;
 
-template <class Ord, class Obj>
-typename std::list<std::pair<Ord, Obj>>::iterator insert_sorted(std::list<std::pair<Ord, Obj>> &list, const Ord &ord, Obj &&obj)
+static std::chrono::steady_clock::duration to_duration(lua_Integer ms)
 {
-	for(auto it = list.begin();; it++)
-	{
-		if(it == list.end() || it->first > ord)
-		{
-			return list.insert(it, std::make_pair(ord, std::forward<Obj>(obj)));
-		}
-	}
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(ms));
 }
 
-static void register_tick(int ticks, handler_t &&handler)
+static size_t budget_handlers = 0;
+static std::chrono::steady_clock::duration budget_time = std::chrono::steady_clock::duration::zero();
+
+static size_t stats_run = 0;
+static size_t stats_deferred = 0;
+static std::chrono::steady_clock::duration stats_maxlate = std::chrono::steady_clock::duration::zero();
+static int stats_maxlateticks = 0;
+
+void lua::timer::setbudget(size_t maxhandlers, long long maxmicros)
 {
-	int time = tick_count + ticks;
-	insert_sorted(tick_handlers, time, std::move(handler));
+	budget_handlers = maxhandlers;
+	budget_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::microseconds(maxmicros > 0 ? maxmicros : 0));
 }
 
-static void register_timer(int interval, handler_t &&handler)
+void lua::timer::getstats(size_t &run, size_t &deferred, long long &maxlate, int &maxlateticks)
 {
-	auto time = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(interval));
-	insert_sorted(timer_handlers, time, std::move(handler));
+	run = stats_run;
+	deferred = stats_deferred;
+	maxlate = std::chrono::duration_cast<std::chrono::milliseconds>(stats_maxlate).count();
+	maxlateticks = stats_maxlateticks;
+}
+
+void lua::timer::resetstats()
+{
+	stats_run = 0;
+	stats_deferred = 0;
+	stats_maxlate = std::chrono::steady_clock::duration::zero();
+	stats_maxlateticks = 0;
 }
 
 void lua::timer::tick()
 {
 	tick_count++;
+	auto start = std::chrono::steady_clock::now();
+	size_t count = 0;
+	auto exhausted = [&]()
 	{
-		auto it = tick_handlers.begin();
-		while(it != tick_handlers.end())
+		if(budget_handlers > 0 && count >= budget_handlers)
 		{
-			auto &pair = *it;
+			return true;
+		}
+		return budget_time.count() > 0 && std::chrono::steady_clock::now() - start >= budget_time;
+	};
 
-			if(pair.first <= tick_count)
-			{
-				auto handler = std::move(pair.second);
-				it = tick_handlers.erase(it);
-				handler();
-			}else{
-				break;
-			}
+	handler_t handler;
+	int due_tick;
+	while(!exhausted() && tick_handlers.pop(tick_count, handler, due_tick))
+	{
+		if(tick_count - due_tick > stats_maxlateticks)
+		{
+			stats_maxlateticks = tick_count - due_tick;
 		}
+		count++;
+		stats_run++;
+		handler_t current = std::move(handler);
+		current();
 	}
 	if(tick_handlers.empty())
 	{
@@ -65,35 +86,236 @@ void lua::timer::tick()
 	}
 
 	auto now = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point due_time;
+	while(!exhausted() && timer_handlers.pop(now, handler, due_time))
+	{
+		if(now - due_time > stats_maxlate)
+		{
+			stats_maxlate = now - due_time;
+		}
+		count++;
+		stats_run++;
+		handler_t current = std::move(handler);
+		current();
+	}
+
+	if(exhausted())
+	{
+		// the rest stays in the queues and runs on the next ticks in deadline order; each handler is counted once
+		stats_deferred += tick_handlers.defer_due(tick_count) + timer_handlers.defer_due(now);
+	}
+}
+
+
+
+struct timer_info
+{
+	lua_State *L;
+	std::weak_ptr<char> lifetime;
+	int ref = LUA_NOREF;
+	aux::timer_id id = 0;
+	bool ticks;
+	lua_Integer period = 0;
+	int due_tick;
+	std::chrono::steady_clock::time_point due_time;
+
+	timer_info(lua_State *L, const std::weak_ptr<char> &lifetime, bool ticks) : L(L), lifetime(lifetime), ticks(ticks)
+	{
+
+	}
+
+	static void schedule(const std::shared_ptr<timer_info> &info, lua_Integer interval)
+	{
+		if(info->ticks)
+		{
+			info->due_tick = tick_count + (int)interval;
+		}else{
+			info->due_time = std::chrono::steady_clock::now() + to_duration(interval);
+		}
+		enqueue(info);
+	}
+
+	static void rearm(const std::shared_ptr<timer_info> &info)
+	{
+		// the next deadline is based on the previous one, skipping missed periods
+		if(info->ticks)
+		{
+			info->due_tick += (int)info->period;
+			if(info->due_tick <= tick_count)
+			{
+				info->due_tick += (int)(((tick_count - info->due_tick) / info->period + 1) * info->period);
+			}
+		}else{
+			auto period = to_duration(info->period);
+			auto now = std::chrono::steady_clock::now();
+			info->due_time += period;
+			if(info->due_time <= now)
+			{
+				info->due_time += ((now - info->due_time) / period + 1) * period;
+			}
+		}
+		enqueue(info);
+	}
+
+	bool unschedule()
+	{
+		if(id == 0)
+		{
+			return false;
+		}
+		bool ok = info_queue_cancel(ticks, id);
+		id = 0;
+		return ok;
+	}
+
+	void release()
 	{
-		auto it = timer_handlers.begin();
-		while(it != timer_handlers.end())
+		if(ref != LUA_NOREF)
 		{
-			auto &pair = *it;
+			luaL_unref(L, LUA_REGISTRYINDEX, ref);
+			ref = LUA_NOREF;
+		}
+	}
 
-			if(pair.first <= now)
+	void fire(const std::shared_ptr<timer_info> &self)
+	{
+		id = 0;
+		if(auto lock = lifetime.lock())
+		{
+			lua::stackguard guard(L);
+			luaL_checkstack(L, 2, nullptr);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+			int err = lua_pcall(L, 0, 1, 0);
+			bool stop = false;
+			if(err != LUA_OK)
 			{
-				auto handler = std::move(pair.second);
-				it = timer_handlers.erase(it);
-				handler();
+				lua::report_error(L, err);
 			}else{
-				break;
+				stop = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+			}
+			lua_pop(L, 1);
+			if(id == 0)
+			{
+				// not rescheduled from the handler
+				if(period > 0 && !stop && ref != LUA_NOREF)
+				{
+					rearm(self);
+				}else{
+					release();
+				}
 			}
 		}
 	}
+
+private:
+	static void enqueue(const std::shared_ptr<timer_info> &info)
+	{
+		info->unschedule();
+		handler_t handler = [info]()
+		{
+			info->fire(info);
+		};
+		if(info->ticks)
+		{
+			info->id = tick_handlers.add(info->due_tick, std::move(handler));
+		}else{
+			info->id = timer_handlers.add(info->due_time, std::move(handler));
+		}
+	}
+
+	static bool info_queue_cancel(bool ticks, aux::timer_id id)
+	{
+		return ticks ? tick_handlers.cancel(id) : timer_handlers.cancel(id);
+	}
+};
+
+static const char TIMERMTKEY = 0;
+
+static std::shared_ptr<timer_info> &checktimer(lua_State *L, int idx)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &TIMERMTKEY);
+	auto data = lua::testudata(L, idx, -1);
+	lua_pop(L, 1);
+	if(!data)
+	{
+		lua::argerrortype(L, idx, "timer");
+	}
+	return *reinterpret_cast<std::shared_ptr<timer_info>*>(data);
 }
 
-void lua::timer::close()
+namespace lua
 {
-	tick_handlers.clear();
-	timer_handlers.clear();
+	template <>
+	struct mt_ctor<std::shared_ptr<timer_info>>
+	{
+		bool operator()(lua_State *L)
+		{
+			if(lua_rawgetp(L, LUA_REGISTRYINDEX, &TIMERMTKEY) == LUA_TTABLE)
+			{
+				return true;
+			}
+			lua_pop(L, 1);
+
+			lua_createtable(L, 0, 4);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &TIMERMTKEY);
+
+			lua::pushliteral(L, "timer");
+			lua_setfield(L, -2, "__name");
+
+			lua_createtable(L, 0, 3);
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checktimer(L, 1);
+				bool ok = info->unschedule();
+				info->release();
+				lua_pushboolean(L, ok);
+				return 1;
+			});
+			lua_setfield(L, -2, "cancel");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checktimer(L, 1);
+				auto interval = luaL_checkinteger(L, 2);
+				if(info->ref == LUA_NOREF)
+				{
+					lua_pushboolean(L, false);
+					return 1;
+				}
+				timer_info::schedule(info, interval);
+				lua_pushboolean(L, true);
+				return 1;
+			});
+			lua_setfield(L, -2, "reschedule");
+			lua_pushcfunction(L, [](lua_State *L)
+			{
+				auto &info = checktimer(L, 1);
+				lua_pushboolean(L, info->id != 0);
+				return 1;
+			});
+			lua_setfield(L, -2, "pending");
+			lua_setfield(L, -2, "__index");
+
+			return true;
+		}
+	};
 }
 
-template <void (*Register)(int interval, handler_t &&handler)>
+template <bool Ticks, bool Repeat>
 static int settimer(lua_State *L)
 {
+	if(Repeat && lua_isinteger(L, 1) && lua_isfunction(L, 2))
+	{
+		lua_pushvalue(L, 1);
+		lua_remove(L, 1);
+		lua_insert(L, 2);
+	}
 	luaL_checktype(L, 1, LUA_TFUNCTION);
 	auto interval = luaL_checkinteger(L, 2);
+	if(Repeat && interval <= 0)
+	{
+		return luaL_argerror(L, 2, "out of range");
+	}
 	lua_remove(L, 2);
 	if(lua_gettop(L) > 1)
 	{
@@ -107,26 +329,17 @@ static int settimer(lua_State *L)
 	
 	int ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-	std::weak_ptr<char> handle = lua::touserdata<std::shared_ptr<char>>(L, lua_upvalueindex(1));
-	L = lua::mainthread(L);
-	Register((int)interval, [=]()
+	auto &lifetime = lua::touserdata<std::shared_ptr<char>>(L, lua_upvalueindex(1));
+	auto info = std::make_shared<timer_info>(lua::mainthread(L), lifetime, Ticks);
+	info->ref = ref;
+	if(Repeat)
 	{
-		if(auto lock = handle.lock())
-		{
-			lua::stackguard guard(L);
-			luaL_checkstack(L, 2, nullptr);
-			lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-			luaL_unref(L, LUA_REGISTRYINDEX, ref);
-			int err = lua_pcall(L, 0, 0, 0);
-			if(err != LUA_OK)
-			{
-				lua::report_error(L, err);
-				lua_pop(L, 1);
-			}
-		}
-	});
+		info->period = interval;
+	}
+	timer_info::schedule(info, interval);
 
-	return 0;
+	lua::pushuserdata(L, std::move(info));
+	return 1;
 }
 
 static const char HOOKKEY = 0;
@@ -228,24 +441,29 @@ static int parallel(lua_State *L)
 	return lua::tailcall(L, lua_gettop(L) - 1);
 }
 
+// outside async, sleep blocks the server thread, so only short intervals are allowed
+static const lua_Integer SLEEP_MAXBLOCK = 100;
+
 static int sleep(lua_State *L)
 {
 	auto interval = luaL_checkinteger(L, 1);
-	auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(interval));
-	
-	auto end = std::chrono::steady_clock::now() + duration;
-	lua_pushvalue(L, lua_upvalueindex(1));
-	lua::pushcfunction(L, [=](lua_State *L)
+	if(lua::isasync(L))
 	{
-		if(std::chrono::steady_clock::now() >= end)
-		{
-			lua_pushboolean(L, true);
-			return 1;
-		}
-		std::this_thread::yield();
-		return 0;
-	});
-	return lua::tailcall(L, 1);
+		// suspend on the scheduler like timer.wait
+		lua_settop(L, 1);
+		lua_pushvalue(L, lua_upvalueindex(1));
+		lua_insert(L, 1);
+		return lua::tailyield(L, 2);
+	}
+	if(interval > SLEEP_MAXBLOCK)
+	{
+		return lua::argerror(L, 1, "cannot block for more than %d ms outside 'async'", (int)SLEEP_MAXBLOCK);
+	}
+	if(interval > 0)
+	{
+		std::this_thread::sleep_for(to_duration(interval));
+	}
+	return 0;
 }
 
 static int wait(lua_State *L)
@@ -272,9 +490,94 @@ static void timeout_hook(lua_State *L, lua_Debug *ar)
 	}
 }
 
+class timeout_watchdog
+{
+	typedef std::chrono::steady_clock::time_point time_point;
+
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::thread thread;
+	bool stopping = false;
+	aux::timer_queue<time_point, lua_State*> deadlines;
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!stopping)
+		{
+			time_point next;
+			if(!deadlines.next(next))
+			{
+				signal.wait(lock);
+				continue;
+			}
+			if(std::chrono::steady_clock::now() < next)
+			{
+				signal.wait_until(lock, next);
+				continue;
+			}
+			lua_State *L;
+			while(deadlines.pop(std::chrono::steady_clock::now(), L))
+			{
+				lua_sethook(L, timeout_hook, LUA_MASKCOUNT, 1);
+			}
+		}
+	}
+
+public:
+	~timeout_watchdog()
+	{
+		stop();
+	}
+
+	aux::timer_id arm(lua_State *L, std::chrono::steady_clock::duration duration)
+	{
+		auto deadline = std::chrono::steady_clock::now() + duration;
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!thread.joinable())
+		{
+			stopping = false;
+			thread = std::thread(&timeout_watchdog::run, this);
+		}
+		time_point next;
+		bool earlier = !deadlines.next(next) || deadline < next;
+		auto id = deadlines.add(deadline, std::move(L));
+		if(earlier)
+		{
+			signal.notify_one();
+		}
+		return id;
+	}
+
+	void disarm(lua_State *L, aux::timer_id id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(!deadlines.cancel(id) && lua_gethook(L) == timeout_hook)
+		{
+			lua_sethook(L, nullptr, 0, 0);
+		}
+	}
+
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			deadlines.clear();
+			signal.notify_one();
+		}
+		if(thread.joinable())
+		{
+			thread.join();
+		}
+	}
+};
+
+static timeout_watchdog watchdog;
+
 static int timeout(lua_State *L)
 {
-	auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(luaL_checkinteger(L, 1)));
+	auto duration = to_duration(luaL_checkinteger(L, 1));
 	lua_remove(L, 1);
 
 	if(!lua_isfunction(L, 1) && !lua_isthread(L, 1))
@@ -282,14 +585,6 @@ static int timeout(lua_State *L)
 		return lua::argerrortype(L, 1, "function or thread");
 	}
 
-	struct signal
-	{
-		bool ended = false;
-		std::mutex hook_mutex;
-	};
-
-	auto info = std::make_shared<signal>();
-
 	lua_State *lthread;
 	if(lua_isthread(L, 1))
 	{
@@ -298,34 +593,19 @@ static int timeout(lua_State *L)
 		lthread = L;
 	}
 
-	std::thread([=]()
-	{
-		std::this_thread::sleep_for(duration);
-		
-		std::lock_guard<std::mutex> lock(info->hook_mutex);
-		if(!info->ended)
-		{
-			lua_sethook(lthread, timeout_hook, LUA_MASKCOUNT, 1);
-		}
-	}).detach();
+	auto id = watchdog.arm(lthread, duration);
 
 	if(lua_isthread(L, 1))
 	{
 		int nargs = lua_gettop(L) - 1;
 		if(!lua_checkstack(lthread, nargs))
 		{
+			watchdog.disarm(lthread, id);
 			return luaL_error(L, "stack overflow");
 		}
 		lua_xmove(L, lthread, nargs);
 		int status = lua_resume(lthread, L, nargs);
-		{
-			std::lock_guard<std::mutex> lock(info->hook_mutex);
-			info->ended = true;
-			if(lua_gethook(lthread) == timeout_hook)
-			{
-				lua_sethook(lthread, nullptr, 0, 0);
-			}
-		}
+		watchdog.disarm(lthread, id);
 		switch(status)
 		{
 			case LUA_OK:
@@ -341,14 +621,7 @@ static int timeout(lua_State *L)
 	}else{
 		return lua::pcallk(L, lua_gettop(L) - 1, lua::numresults(L), 0, [=](lua_State *L, int status)
 		{
-			{
-				std::lock_guard<std::mutex> lock(info->hook_mutex);
-				info->ended = true;
-				if(lua_gethook(L) == timeout_hook)
-				{
-					lua_sethook(L, nullptr, 0, 0);
-				}
-			}
+			watchdog.disarm(L, id);
 			switch(status)
 			{
 				case LUA_OK:
@@ -361,6 +634,30 @@ static int timeout(lua_State *L)
 	}
 }
 
+static int stats(lua_State *L)
+{
+	size_t run, deferred;
+	long long maxlate;
+	int maxlateticks;
+	lua::timer::getstats(run, deferred, maxlate, maxlateticks);
+	if(lua_toboolean(L, 1))
+	{
+		lua::timer::resetstats();
+	}
+	lua_pushinteger(L, (lua_Integer)run);
+	lua_pushinteger(L, (lua_Integer)deferred);
+	lua_pushinteger(L, (lua_Integer)maxlate);
+	lua_pushinteger(L, maxlateticks);
+	return 4;
+}
+
+void lua::timer::close()
+{
+	tick_handlers.clear();
+	timer_handlers.clear();
+	watchdog.stop();
+}
+
 int lua::timer::loader(lua_State *L)
 {
 	lua_createtable(L, 0, 2);
@@ -368,11 +665,17 @@ int lua::timer::loader(lua_State *L)
 
 	lua::pushuserdata(L, std::make_shared<char>());
 	lua_pushvalue(L, -1);
-	lua_pushcclosure(L, settimer<register_timer>, 1);
+	lua_pushcclosure(L, settimer<false, false>, 1);
 	lua_setfield(L, table, "ms");
 	lua_pushvalue(L, -1);
-	lua_pushcclosure(L, settimer<register_tick>, 1);
+	lua_pushcclosure(L, settimer<true, false>, 1);
 	lua_setfield(L, table, "tick");
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, settimer<false, true>, 1);
+	lua_setfield(L, table, "every");
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, settimer<true, true>, 1);
+	lua_setfield(L, table, "everytick");
 	luaL_ref(L, LUA_REGISTRYINDEX);
 
 	lua_pushcfunction(L, parallelex);
@@ -391,7 +694,7 @@ int lua::timer::loader(lua_State *L)
 	lua_pushcclosure(L, parallel, 2);
 	lua_setfield(L, table, "parallel");
 
-	lua::loadbufferx(L, "local f=...;while not f() do end", "='sleep'", nullptr);
+	lua_getfield(L, table, "ms");
 	lua_pushcclosure(L, sleep, 1);
 	lua_setfield(L, table, "sleep");
 
@@ -406,16 +709,15 @@ int lua::timer::loader(lua_State *L)
 	lua_pushcfunction(L, timeout);
 	lua_setfield(L, table, "timeout");
 
+	lua_pushcfunction(L, stats);
+	lua_setfield(L, table, "stats");
+
 	lua::loadbufferx(L, R"END(
 local timer = ...
 function timer.new(func, scheduler, ...)
   local elapsed = false
   local cancelled = false
-  return {
-    elapsed = function() return elapsed end,
-    cancelled = function() return cancelled end,
-    cancel = function() cancelled = true end
-  }, scheduler(
+  local handle = scheduler(
     function(...)
       elapsed = true
       if not cancelled then
@@ -423,6 +725,16 @@ function timer.new(func, scheduler, ...)
       end
     end, ...
   )
+  return {
+    elapsed = function() return elapsed end,
+    cancelled = function() return cancelled end,
+    cancel = function()
+      cancelled = true
+      if type(handle) == 'userdata' then
+        handle:cancel()
+      end
+    end
+  }, handle
 end
 )END", "='timer'", nullptr);
 	lua_pushvalue(L, table);
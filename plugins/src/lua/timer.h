@@ -11,6 +11,9 @@ namespace lua
 		void close();
 		void tick();
 		bool pushyielded(lua_State *L, lua_State *from);
+		void setbudget(size_t maxhandlers, long long maxmicros);
+		void getstats(size_t &run, size_t &deferred, long long &maxlate, int &maxlateticks);
+		void resetstats();
 	}
 }
 
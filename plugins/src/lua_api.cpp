@@ -3,7 +3,11 @@
 #include "lua/timer.h"
 #include "lua/interop.h"
 #include "lua/remote.h"
+#include "lua/serial.h"
+#include "lua/compiler.h"
 #include "main.h"
+#include "lua/lstate.h"
+#include "lua/lfunc.h"
 
 #include <vector>
 #include <memory>
@@ -82,57 +86,192 @@ static int table_copy(lua_State *L)
 	return 0;
 }
 
-static int async(lua_State *L)
+static const char ASYNCPOOLKEY = 0;
+
+// a thread that has grown deeper than this is left to the collector instead of keeping its stack in the pool
+static const int async_maxstack = 8 * BASIC_STACK_SIZE;
+static const int async_maxci = 32;
+
+struct async_pool
 {
-	luaL_checktype(L, 1, LUA_TFUNCTION);
-	lua_newthread(L);
-	lua_pushnil(L);
-	lua_pushcclosure(L, [](lua_State *L)
+	size_t limit = 32;
+	size_t created = 0;
+	size_t reused = 0;
+};
+
+static async_pool &pushasyncpool(lua_State *L)
+{
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &ASYNCPOOLKEY) == LUA_TUSERDATA)
 	{
-		auto thread = lua_tothread(L, lua_upvalueindex(1));
-		int num = lua_gettop(L);
-		if(!lua_checkstack(thread, num))
-		{
-			return luaL_error(L, "stack overflow");
-		}
-		lua_xmove(L, thread, num);
-		if(lua_status(thread) == LUA_OK)
+		return lua::touserdata<async_pool>(L, -1);
+	}
+	lua_pop(L, 1);
+	auto &pool = lua::newuserdata<async_pool>(L);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &ASYNCPOOLKEY);
+	return pool;
+}
+
+static const char ASYNCTHREADSKEY = 0;
+
+bool lua::isasync(lua_State *L)
+{
+	if(!lua_isyieldable(L))
+	{
+		return false;
+	}
+	luaL_checkstack(L, 3, nullptr);
+	bool result = false;
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &ASYNCTHREADSKEY) == LUA_TTABLE)
+	{
+		lua_pushthread(L);
+		result = lua_rawget(L, -2) != LUA_TNIL;
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return result;
+}
+
+static int async_resume(lua_State *L)
+{
+	auto thread = lua_tothread(L, lua_upvalueindex(1));
+	if(!thread)
+	{
+		// the task has finished and its thread may already run another one
+		return luaL_error(L, "cannot resume dead coroutine");
+	}
+	int num = lua_gettop(L);
+	if(!lua_checkstack(thread, num))
+	{
+		return luaL_error(L, "stack overflow");
+	}
+	lua_xmove(L, thread, num);
+	if(lua_status(thread) == LUA_OK)
+	{
+		num--;
+	}
+	switch(lua_resume(thread, L, num))
+	{
+		case LUA_OK:
 		{
-			num--;
+			num = lua_gettop(thread);
+			luaL_checkstack(L, num + 3, nullptr);
+			lua_xmove(thread, L, num);
+
+			// the finished thread is reset and kept for the next async call, detached from this continuation
+			if(lua_gethook(thread))
+			{
+				lua_sethook(thread, nullptr, 0, 0);
+			}
+			auto &pool = pushasyncpool(L);
+			lua_getuservalue(L, -1);
+			auto idle = lua_rawlen(L, -1);
+			if(idle < pool.limit && thread->stacksize <= async_maxstack && thread->nci <= async_maxci)
+			{
+				lua_pushvalue(L, lua_upvalueindex(1));
+				lua_rawseti(L, -2, idle + 1);
+			}
+			lua_pop(L, 2);
+			lua_pushnil(L);
+			lua_replace(L, lua_upvalueindex(1));
+			return num;
 		}
-		switch(lua_resume(thread, L, num))
-		{
-			case LUA_OK:
-				num = lua_gettop(thread);
-				luaL_checkstack(L, num, nullptr);
-				lua_xmove(thread, L, num);
-				return num;
-			case LUA_YIELD:
-				num = lua_gettop(thread);
-				if(num == 0 || !lua_isfunction(thread, 1))
+		case LUA_YIELD:
+			num = lua_gettop(thread);
+			if(num == 0 || !lua_isfunction(thread, 1))
+			{
+				if(!lua::timer::pushyielded(L, thread))
 				{
-					if(!lua::timer::pushyielded(L, thread))
-					{
-						return luaL_error(L, "inner function must yield a function to register the continuation");
-					}
-				}else{
-					luaL_checkstack(L, num + 2, nullptr);
-					lua_xmove(thread, L, num);
+					return luaL_error(L, "inner function must yield a function to register the continuation");
 				}
-				lua_pushvalue(L, lua_upvalueindex(2));
-				lua_insert(L, 2);
-				return lua::tailcall(L, lua_gettop(L) - 1);
-			default:
-				lua_xmove(thread, L, 1);
-				return lua_error(L);
+			}else{
+				luaL_checkstack(L, num + 2, nullptr);
+				lua_xmove(thread, L, num);
+			}
+			lua_pushvalue(L, lua_upvalueindex(2));
+			lua_insert(L, 2);
+			return lua::tailcall(L, lua_gettop(L) - 1);
+		default:
+			lua_xmove(thread, L, 1);
+			return lua_error(L);
+	}
+}
+
+static int async(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	auto &pool = pushasyncpool(L);
+	lua_getuservalue(L, -1);
+	auto idle = lua_rawlen(L, -1);
+	if(idle > 0)
+	{
+		lua_rawgeti(L, -1, idle);
+		lua_pushnil(L);
+		lua_rawseti(L, -3, idle);
+		pool.reused++;
+	}else{
+		lua_newthread(L);
+		pool.created++;
+
+		// other coroutines may be yieldable too, so the threads of async are remembered
+		if(lua_rawgetp(L, LUA_REGISTRYINDEX, &ASYNCTHREADSKEY) != LUA_TTABLE)
+		{
+			lua_pop(L, 1);
+			lua_newtable(L);
+			lua_createtable(L, 0, 1);
+			lua::pushliteral(L, "k");
+			lua_setfield(L, -2, "__mode");
+			lua_setmetatable(L, -2);
+			lua_pushvalue(L, -1);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, &ASYNCTHREADSKEY);
 		}
-	}, 2);
+		lua_pushvalue(L, -2);
+		lua_pushboolean(L, true);
+		lua_rawset(L, -3);
+		lua_pop(L, 1);
+	}
+	// only the thread is pooled, every task gets its own continuation
+	lua_pushnil(L);
+	lua_pushcclosure(L, async_resume, 2);
+	lua_pushvalue(L, -1);
+	lua_setupvalue(L, -2, 2);
 	lua_insert(L, 1);
-	lua_pushvalue(L, 1);
-	lua_setupvalue(L, 1, 2);
+	lua_pop(L, 2);
 	return lua::tailcall(L, lua_gettop(L) - 1);
 }
 
+static int asyncpool(lua_State *L)
+{
+	bool set = !lua_isnoneornil(L, 1);
+	lua_Integer limit = set ? luaL_checkinteger(L, 1) : 0;
+	if(limit < 0)
+	{
+		return luaL_argerror(L, 1, "out of range");
+	}
+	lua_settop(L, 0);
+	auto &pool = pushasyncpool(L);
+	if(set)
+	{
+		pool.limit = (size_t)limit;
+		lua_getuservalue(L, -1);
+		for(auto idle = lua_rawlen(L, -1); idle > pool.limit; idle--)
+		{
+			lua_pushnil(L);
+			lua_rawseti(L, -2, idle);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, (lua_Integer)pool.limit);
+	lua_pushinteger(L, (lua_Integer)pool.created);
+	lua_pushinteger(L, (lua_Integer)pool.reused);
+	// each reuse avoids a new thread with its initial stack
+	size_t saved = sizeof(lua_State) + BASIC_STACK_SIZE * sizeof(TValue);
+	lua_pushinteger(L, (lua_Integer)(pool.reused * saved));
+	return 4;
+}
+
 static int import(lua_State *L)
 {
 	lua_Debug ar;
@@ -445,6 +584,7 @@ static int open_package(lua_State *L)
 	lua::pushliteral(L, "plugins" LUA_DIRSEP "lua" LUA_DIRSEP "?.so");
 #endif
 	lua_setfield(L, -2, "cpath");
+	lua::compiler::init_package(L, -1);
 	return 1;
 }
 
@@ -464,6 +604,8 @@ static int open_base(lua_State *L)
 	lua_setfield(L, table, "bind");
 	lua_pushcfunction(L, async);
 	lua_setfield(L, table, "async");
+	lua_pushcfunction(L, asyncpool);
+	lua_setfield(L, table, "asyncpool");
 	lua_pushcfunction(L, import);
 	lua_setfield(L, table, "import");
 
@@ -532,30 +674,55 @@ static int open_debug(lua_State *L)
 	return 1;
 }
 
-static const char HOOKKEY = 0;
+void coroutine_hookfunc(lua_State *L, lua_Debug *ar);
+
+// the parent of a hooked coroutine is kept in its extra space
+static lua_State *&hookparent(lua_State *L)
+{
+	return *reinterpret_cast<lua_State**>(lua_getextraspace(L));
+}
+
+static lua_State *hooksource(lua_State *parent)
+{
+	while(parent && lua_gethook(parent) == coroutine_hookfunc)
+	{
+		parent = hookparent(parent);
+	}
+	return parent;
+}
+
+static void synchook(lua_State *L, lua_State *source)
+{
+	// count-only parents are followed at their own rate; the count also picks up later changes to the parent's hook
+	const int poll = 100;
+	int mask = source && lua_gethook(source) ? lua_gethookmask(source) : 0;
+	int count = (mask & LUA_MASKCOUNT) ? lua_gethookcount(source) : poll;
+	mask |= LUA_MASKCOUNT;
+	if(lua_gethook(L) != coroutine_hookfunc || lua_gethookmask(L) != mask || lua_gethookcount(L) != count)
+	{
+		lua_sethook(L, coroutine_hookfunc, mask, count);
+	}
+}
 
 void coroutine_hookfunc(lua_State *L, lua_Debug *ar)
 {
-	luaL_checkstack(L, 2, nullptr);
-	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &HOOKKEY) == LUA_TTABLE)
+	auto parent = hooksource(hookparent(L));
+	if(!parent)
 	{
-		lua_pushthread(L);
-		if(lua_rawget(L, -2) == LUA_TTHREAD)
+		lua_sethook(L, nullptr, 0, 0);
+		return;
+	}
+	if(ar->event == LUA_HOOKCOUNT)
+	{
+		synchook(L, parent);
+	}
+	if(auto hook = lua_gethook(parent))
+	{
+		if(lua_gethookmask(parent) & (1 << ar->event))
 		{
-			auto parent = lua_tothread(L, -1);
-			lua_pop(L, 2);
-			if(auto hook = lua_gethook(parent))
-			{
-				if(lua_gethookmask(parent) & (1 << ar->event))
-				{
-					hook(L, ar);
-				}
-			}
-			return;
+			hook(L, ar);
 		}
-		lua_pop(L, 1);
 	}
-	lua_pop(L, 1);
 }
 
 static int coroutine_resumehooked(lua_State *L)
@@ -567,37 +734,19 @@ static int coroutine_resumehooked(lua_State *L)
 	lua_insert(L, 2);
 	if(thread)
 	{
-		lua_sethook(thread, coroutine_hookfunc, LUA_MASKCALL | LUA_MASKCOUNT | LUA_MASKLINE | LUA_MASKRET, 1);
-
-		if(lua_rawgetp(L, LUA_REGISTRYINDEX, &HOOKKEY) != LUA_TTABLE)
-		{
-			lua_pop(L, 1);
-			lua_createtable(L, 0, 2);
-			lua_pushvalue(L, -1);
-			lua_rawsetp(L, LUA_REGISTRYINDEX, &HOOKKEY);
-			lua::pushliteral(L, "k");
-			lua_setfield(L, -2, "__mode");
-			lua_pushvalue(L, -1);
-			lua_setmetatable(L, -2);
-		}
-		lua_pushvalue(L, 1);
-		lua_pushthread(L);
-		lua_rawset(L, -3);
-		lua_pop(L, 1);
+		hookparent(thread) = L;
+		synchook(thread, hooksource(L));
 	}
 	return lua::pcallk(L, lua_gettop(L) - 2, lua::numresults(L), 0, [=](lua_State *L, int status)
 	{
-		if(lua_gethook(thread) == coroutine_hookfunc)
-		{
-			lua_sethook(thread, nullptr, 0, 0);
-		}
-		if(lua_rawgetp(L, LUA_REGISTRYINDEX, &HOOKKEY) == LUA_TTABLE)
+		if(thread)
 		{
-			lua_pushvalue(L, 1);
-			lua_pushnil(L);
-			lua_rawset(L, -3);
+			if(lua_gethook(thread) == coroutine_hookfunc)
+			{
+				lua_sethook(thread, nullptr, 0, 0);
+			}
+			hookparent(thread) = nullptr;
 		}
-		lua_pop(L, 1);
 		switch(status)
 		{
 			case LUA_OK:
@@ -611,6 +760,8 @@ static int coroutine_resumehooked(lua_State *L)
 
 static int open_coroutine(lua_State *L)
 {
+	// new threads copy the extra space of the main thread
+	hookparent(lua::mainthread(L)) = nullptr;
 	luaopen_coroutine(L);
 	lua_getfield(L, -1, "resume");
 	lua_pushcclosure(L, coroutine_resumehooked, 1);
@@ -632,6 +783,7 @@ static std::vector<std::pair<const char*, lua_CFunction>> libs = {
 	{"interop", lua::interop::loader},
 	{"timer", lua::timer::loader},
 	{"remote", lua::remote::loader},
+	{"serial", lua::serial::loader},
 };
 
 void lua::initlibs(lua_State *L, int load, int preload)
@@ -755,6 +907,7 @@ void lua::process_tick()
 			if(!lua::active(*lock))
 			{
 				lua_close(*lock);
+				lua::cleanup(*lock);
 			}else{
 				exit_queue.push(lock);
 			}
@@ -2,9 +2,13 @@
 #include "amx/amxutils.h"
 #include "sdk/amx/amx.h"
 #include "lua/lstate.h"
+#include "utils/size_class_pool.h"
 
 #include <unordered_map>
+#include <memory>
 #include <assert.h>
+#include <cstring>
+#include <cstdio>
 
 void errortable(lua_State *L, int error)
 {
@@ -26,6 +30,113 @@ void errortable(lua_State *L, int error)
 	lua_setmetatable(L, -2);
 }
 
+static const char SLEEPKEY = 0;
+static const char SLEEPMTKEY = 0;
+
+// like luaL_where, but stored in the status object without creating a string
+static void sleepwhere(lua_State *L, lua::sleep_status &status)
+{
+	lua_Debug ar;
+	status.where[0] = '\0';
+	if(lua_getstack(L, 1, &ar))
+	{
+		lua_getinfo(L, "Sl", &ar);
+		if(ar.currentline > 0)
+		{
+			std::snprintf(status.where, sizeof(status.where), "%s:%d: ", ar.short_src, ar.currentline);
+		}
+	}
+}
+
+static lua::sleep_status &pushsleep(lua_State *L)
+{
+	// the last status object is raised again once it has been handled; a new one is needed only while it is still in use
+	luaL_checkstack(L, 4, nullptr);
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &SLEEPKEY) == LUA_TUSERDATA)
+	{
+		auto status = reinterpret_cast<lua::sleep_status*>(lua_touserdata(L, -1));
+		if(!status->busy)
+		{
+			status->busy = true;
+			sleepwhere(L, *status);
+			return *status;
+		}
+	}
+	lua_pop(L, 1);
+	auto status = reinterpret_cast<lua::sleep_status*>(lua_newuserdata(L, sizeof(lua::sleep_status)));
+	status->hasretval = false;
+	status->retval = 0;
+	status->busy = true;
+	sleepwhere(L, *status);
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &SLEEPKEY);
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &SLEEPMTKEY) == LUA_TTABLE)
+	{
+		lua_setmetatable(L, -2);
+		return *status;
+	}
+	lua_pop(L, 1);
+	lua_createtable(L, 0, 3);
+	lua::pushliteral(L, "sleep");
+	lua_setfield(L, -2, "__name");
+	lua_pushcfunction(L, [](lua_State *L)
+	{
+		auto status = reinterpret_cast<lua::sleep_status*>(lua_touserdata(L, 1));
+		lua_pushfstring(L, "%sinternal AMX error %d: %s", status->where, AMX_ERR_SLEEP, amx::StrError(AMX_ERR_SLEEP));
+		return 1;
+	});
+	lua_setfield(L, -2, "__tostring");
+	lua_pushcfunction(L, [](lua_State *L)
+	{
+		auto status = reinterpret_cast<lua::sleep_status*>(lua_touserdata(L, 1));
+		auto key = lua_tostring(L, 2);
+		if(key && !std::strcmp(key, "__amxerr"))
+		{
+			lua_pushinteger(L, AMX_ERR_SLEEP);
+		}else if(key && !std::strcmp(key, "__retval") && status->hasretval)
+		{
+			lua_pushlightuserdata(L, reinterpret_cast<void*>(status->retval));
+		}else if(key && !std::strcmp(key, "__cont"))
+		{
+			lua_getuservalue(L, 1);
+		}else if(key && !std::strcmp(key, "__where"))
+		{
+			lua_pushstring(L, status->where);
+		}else{
+			lua_pushnil(L);
+		}
+		return 1;
+	});
+	lua_setfield(L, -2, "__index");
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &SLEEPMTKEY);
+	lua_setmetatable(L, -2);
+	return *status;
+}
+
+lua::sleep_status *lua::tosleep(lua_State *L, int idx)
+{
+	if(lua_type(L, idx) != LUA_TUSERDATA)
+	{
+		return nullptr;
+	}
+	idx = lua_absindex(L, idx);
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &SLEEPMTKEY);
+	auto data = lua::testudata(L, idx, -1);
+	lua_pop(L, 1);
+	return reinterpret_cast<lua::sleep_status*>(data);
+}
+
+// a status caught by the script (e.g. with pcall) is never handled, so it is released when no public is running
+void lua::resetsleep(lua_State *L)
+{
+	if(lua_rawgetp(L, LUA_REGISTRYINDEX, &SLEEPKEY) == LUA_TUSERDATA)
+	{
+		reinterpret_cast<lua::sleep_status*>(lua_touserdata(L, -1))->busy = false;
+	}
+	lua_pop(L, 1);
+}
+
 int lua::amx_error(lua_State *L, int error)
 {
 	errortable(L, error);
@@ -34,6 +145,15 @@ int lua::amx_error(lua_State *L, int error)
 
 int lua::amx_error(lua_State *L, int error, int retval)
 {
+	if(error == AMX_ERR_SLEEP)
+	{
+		auto &status = pushsleep(L);
+		status.hasretval = true;
+		status.retval = retval;
+		lua_pushnil(L);
+		lua_setuservalue(L, -2);
+		return lua_error(L);
+	}
 	errortable(L, error);
 	lua_pushlightuserdata(L, reinterpret_cast<void*>(retval));
 	lua_setfield(L, -2, "__retval");
@@ -44,11 +164,11 @@ int lua::amx_sleep(lua_State *L, int value, int cont)
 {
 	value = lua_absindex(L, value);
 	cont = lua_absindex(L, cont);
-	errortable(L, AMX_ERR_SLEEP);
-	lua_pushvalue(L, value);
-	lua_setfield(L, -2, "__retval");
+	auto &status = pushsleep(L);
+	status.hasretval = lua_islightuserdata(L, value);
+	status.retval = status.hasretval ? reinterpret_cast<cell>(lua_touserdata(L, value)) : 0;
 	lua_pushvalue(L, cont);
-	lua_setfield(L, -2, "__cont");
+	lua_setuservalue(L, -2);
 	return lua_error(L);
 }
 
@@ -210,38 +330,6 @@ int lua::tailcall(lua_State *L, int n, int r)
 	return lua_gettop(L) - top;
 }
 
-int lua::pcallk(lua_State *L, int nargs, int nresults, int errfunc, lua::KFunction &&k)
-{
-	if(errfunc != 0) errfunc = lua_absindex(L, errfunc);
-	int kpos = lua_absindex(L, -nargs - 1);
-	lua::pushuserdata(L, std::move(k));
-	lua_insert(L, kpos);
-	
-	lua_KFunction kc = [](lua_State *L, int status, lua_KContext kpos)
-	{
-		lua::KFunction k = std::move(lua::touserdata<lua::KFunction>(L, kpos));
-		lua_remove(L, kpos);
-		return k(L, status);
-	};
-	return kc(L, lua_pcallk(L, nargs, nresults, errfunc, kpos, kc), kpos);
-}
-
-int lua::callk(lua_State *L, int nargs, int nresults, lua::KFunction &&k)
-{
-	int kpos = lua_absindex(L, -nargs - 1);
-	lua::pushuserdata(L, std::move(k));
-	lua_insert(L, kpos);
-
-	lua_KFunction kc = [](lua_State *L, int status, lua_KContext kpos)
-	{
-		lua::KFunction k = std::move(lua::touserdata<lua::KFunction>(L, kpos));
-		lua_remove(L, kpos);
-		return k(L, status);
-	};
-	lua_callk(L, nargs, nresults, kpos, kc);
-	return kc(L, LUA_OK, kpos);
-}
-
 bool lua::isnumber(lua_State *L, int idx)
 {
 	return lua_type(L, idx) == LUA_TNUMBER;
@@ -339,20 +427,102 @@ int lua::plen(lua_State *L, int idx)
 	return lua_pcall(L, 1, 1, 0);
 }
 
-static std::unordered_map<void*, lua::Alloc> allocmap;
+struct alloc_info
+{
+	lua_Alloc base;
+	void *base_ud;
+	size_t total;
+	size_t peak;
+	size_t limit;
+};
+
+static std::unordered_map<lua_State*, std::unique_ptr<alloc_info>> allocmap;
+
+static void *limit_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	auto &info = *reinterpret_cast<alloc_info*>(ud);
+	size_t osize_real = ptr == nullptr ? 0 : osize;
+	if(nsize > osize_real && info.total - osize_real + nsize > info.limit)
+	{
+		return nullptr;
+	}
+	void *ret = info.base(info.base_ud, ptr, osize, nsize);
+	if(ret || nsize == 0)
+	{
+		info.total = info.total - osize_real + nsize;
+		if(info.total > info.peak)
+		{
+			info.peak = info.total;
+		}
+	}
+	return ret;
+}
+
+void lua::setmemlimit(lua_State *L, size_t limit)
+{
+	auto &info = allocmap[L];
+	if(!info)
+	{
+		info = std::unique_ptr<alloc_info>(new alloc_info());
+		info->base = lua_getallocf(L, &info->base_ud);
+		info->total = (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+		info->peak = info->total;
+		lua_setallocf(L, limit_alloc, info.get());
+	}
+	info->limit = limit;
+}
 
-void lua::setallocf(lua_State *L, Alloc &&f)
+bool lua::getmemusage(lua_State *L, size_t &current, size_t &peak, size_t &limit)
 {
-	allocmap[L] = std::move(f);
-	lua_setallocf(L, [](void *ud, void *ptr, size_t osize, size_t nsize)
+	void *ud;
+	if(lua_getallocf(L, &ud) == limit_alloc)
 	{
-		return allocmap[ud](ptr, osize, nsize);
-	}, L);
+		auto &info = *reinterpret_cast<alloc_info*>(ud);
+		current = info.total;
+		peak = info.peak;
+		limit = info.limit;
+		return true;
+	}
+	return false;
+}
+
+typedef aux::size_class_pool<8, 256, 16384> alloc_pool;
+
+static std::unordered_map<lua_State*, std::unique_ptr<alloc_pool>> poolmap;
+
+static void *pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	return reinterpret_cast<alloc_pool*>(ud)->reallocate(ptr, ptr == nullptr ? 0 : osize, nsize);
+}
+
+lua_State *lua::newpooledstate()
+{
+	std::unique_ptr<alloc_pool> pool(new alloc_pool());
+	auto L = lua_newstate(pool_alloc, pool.get());
+	if(L)
+	{
+		poolmap[L] = std::move(pool);
+	}
+	return L;
+}
+
+bool lua::getpoolstats(lua_State *L, size_t &hits, size_t &misses, size_t &large)
+{
+	auto it = poolmap.find(L);
+	if(it != poolmap.end())
+	{
+		hits = it->second->hits;
+		misses = it->second->misses;
+		large = it->second->large;
+		return true;
+	}
+	return false;
 }
 
 void lua::cleanup(lua_State *L)
 {
 	allocmap.erase(L);
+	poolmap.erase(L);
 }
 
 bool lua::active(lua_State *L)
@@ -4,13 +4,16 @@
 #include "lua/lualibs.h"
 #include <type_traits>
 #include <functional>
+#include <cstring>
 
 #if __GNUG__ && __GNUC__ < 5
 #define is_trivially_constructible(T) __has_trivial_constructor(T)
 #define is_trivially_destructible(T) __has_trivial_destructor(T)
+#define is_trivially_copyable(T) __has_trivial_copy(T)
 #else
 #define is_trivially_constructible(T) std::is_trivially_constructible<T>::value
 #define is_trivially_destructible(T) std::is_trivially_destructible<T>::value
+#define is_trivially_copyable(T) std::is_trivially_copyable<T>::value
 #endif
 
 namespace lua
@@ -24,9 +27,19 @@ namespace lua
 		}
 	};
 
+	struct sleep_status
+	{
+		bool hasretval;
+		int retval;
+		bool busy;
+		char where[LUA_IDSIZE + 16];
+	};
+
 	int amx_error(lua_State *L, int error);
 	int amx_error(lua_State *L, int error, int retval);
 	int amx_sleep(lua_State *L, int value, int cont);
+	sleep_status *tosleep(lua_State *L, int idx);
+	void resetsleep(lua_State *L);
 
 	template <class Type>
 	struct _udata
@@ -151,11 +164,81 @@ namespace lua
 	int tailcall(lua_State *L, int n);
 	int tailcall(lua_State *L, int n, int r);
 
-	typedef std::function<int(lua_State *L, int status)> KFunction;
+	template <class Func, bool Small = sizeof(Func) <= sizeof(lua_KContext)>
+	struct kfunction;
+
+	// small continuations are stored directly in the context
+	template <class Func>
+	struct kfunction<Func, true>
+	{
+		static lua_KContext store(lua_State* /*L*/, int /*kpos*/, const Func &k)
+		{
+			lua_KContext ctx = 0;
+			std::memcpy(&ctx, &k, sizeof(Func));
+			return ctx;
+		}
+
+		static int cont(lua_State *L, int status, lua_KContext ctx)
+		{
+			typename std::aligned_storage<sizeof(Func), alignof(Func)>::type k;
+			std::memcpy(&k, &ctx, sizeof(Func));
+			return reinterpret_cast<Func&>(k)(L, status);
+		}
+	};
+
+	// larger ones are split into light userdata below the called function
+	template <class Func>
+	struct kfunction<Func, false>
+	{
+		static constexpr int slots = (sizeof(Func) + sizeof(void*) - 1) / sizeof(void*);
+
+		static lua_KContext store(lua_State *L, int kpos, const Func &k)
+		{
+			luaL_checkstack(L, slots, nullptr);
+			void *data[slots] = {};
+			std::memcpy(data, &k, sizeof(Func));
+			for(int i = 0; i < slots; i++)
+			{
+				lua_pushlightuserdata(L, data[i]);
+			}
+			lua_rotate(L, kpos, slots);
+			return kpos;
+		}
+
+		static int cont(lua_State *L, int status, lua_KContext kpos)
+		{
+			union
+			{
+				void *data[slots];
+				typename std::aligned_storage<sizeof(Func), alignof(Func)>::type k;
+			};
+			for(int i = 0; i < slots; i++)
+			{
+				data[i] = lua_touserdata(L, (int)kpos + i);
+			}
+			lua_rotate(L, (int)kpos, -slots);
+			lua_pop(L, slots);
+			return reinterpret_cast<Func&>(k)(L, status);
+		}
+	};
 
-	int pcallk(lua_State *L, int nargs, int nresults, int errfunc, KFunction &&k);
+	template <class Func>
+	int pcallk(lua_State *L, int nargs, int nresults, int errfunc, Func k)
+	{
+		static_assert(is_trivially_copyable(Func) && is_trivially_destructible(Func), "continuation must be trivially copyable");
+		if(errfunc != 0) errfunc = lua_absindex(L, errfunc);
+		lua_KContext ctx = kfunction<Func>::store(L, lua_absindex(L, -nargs - 1), k);
+		return kfunction<Func>::cont(L, lua_pcallk(L, nargs, nresults, errfunc, ctx, kfunction<Func>::cont), ctx);
+	}
 
-	int callk(lua_State *L, int nargs, int nresults, KFunction &&k);
+	template <class Func>
+	int callk(lua_State *L, int nargs, int nresults, Func k)
+	{
+		static_assert(is_trivially_copyable(Func) && is_trivially_destructible(Func), "continuation must be trivially copyable");
+		lua_KContext ctx = kfunction<Func>::store(L, lua_absindex(L, -nargs - 1), k);
+		lua_callk(L, nargs, nresults, ctx, kfunction<Func>::cont);
+		return kfunction<Func>::cont(L, LUA_OK, ctx);
+	}
 
 	bool isnumber(lua_State *L, int idx);
 
@@ -181,9 +264,10 @@ namespace lua
 
 	int plen(lua_State *L, int idx);
 
-	typedef std::function<void*(void *ptr, size_t osize, size_t nsize)> Alloc;
-
-	void setallocf(lua_State *L, Alloc &&f);
+	void setmemlimit(lua_State *L, size_t limit);
+	lua_State *newpooledstate();
+	bool getpoolstats(lua_State *L, size_t &hits, size_t &misses, size_t &large);
+	bool getmemusage(lua_State *L, size_t &current, size_t &peak, size_t &limit);
 	void cleanup(lua_State *L);
 
 	bool active(lua_State *L);
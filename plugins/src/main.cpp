@@ -4,8 +4,10 @@
 #include "amx/amxutils.h"
 #include "lua_api.h"
 #include "lua/interop.h"
+#include "lua/interop/router.h"
 #include "lua/timer.h"
 #include "lua/remote.h"
+#include "lua/compiler.h"
 #include "amx/fileutils.h"
 
 #include "sdk/amx/amx.h"
@@ -37,6 +39,8 @@ PLUGIN_EXPORT void PLUGIN_CALL Unload()
 {
 	lua::timer::close();
 	lua::remote::close();
+	lua::compiler::close();
+	lua::interop::router_close();
 	hooks::unload();
 
 	logprintf(" YALP v1.1.1 unloaded");
@@ -59,4 +63,7 @@ PLUGIN_EXPORT void PLUGIN_CALL ProcessTick()
 {
 	lua::process_tick();
 	lua::timer::tick();
+	lua::compiler::tick();
+	lua::remote::tick();
+	lua::interop::router_tick();
 }
@@ -4,6 +4,9 @@
 #include "lua_utils.h"
 #include "lua_adapt.h"
 #include "amx/fileutils.h"
+#include "lua/timer.h"
+#include "lua/compiler.h"
+#include "lua/interop/router.h"
 
 #include <string>
 #include <iomanip>
@@ -11,15 +14,12 @@
 #include <cctype>
 #include <cstring>
 #include <sstream>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 
-// native Lua:lua_newstate(lua_lib:load=lua_baselibs, lua_lib:preload=lua_newlibs, memlimit=-1);
+// native Lua:lua_newstate(lua_lib:load=lua_baselibs, lua_lib:preload=lua_newlibs, memlimit=-1, bool:pooled=false);
 static cell AMX_NATIVE_CALL n_lua_newstate(AMX *amx, cell *params)
 {
 	if(!lua::check_params(amx, params, 0)) return 0;
-	auto L = luaL_newstate();
+	auto L = optparam(4, 0) ? lua::newpooledstate() : luaL_newstate();
 	if(L)
 	{
 		lua_atpanic(L, lua::atpanic);
@@ -27,25 +27,7 @@ static cell AMX_NATIVE_CALL n_lua_newstate(AMX *amx, cell *params)
 
 		if(memlimit >= 0)
 		{
-			long long total = lua_gc(L, LUA_GCCOUNT, 0);
-			total = total * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
-
-			void *ud;
-			auto oldalloc = lua_getallocf(L, &ud);
-			lua::setallocf(L, [=](void *ptr, size_t osize, size_t nsize) mutable
-			{
-				size_t osize_real = ptr == nullptr ? 0 : osize;
-				if(total - osize_real + nsize > memlimit)
-				{
-					return static_cast<void*>(nullptr);
-				}
-				void *ret = oldalloc(ud, ptr, osize, nsize);
-				if(ret || nsize == 0)
-				{
-					total = total - osize_real + nsize;
-				}
-				return ret;
-			});
+			lua::setmemlimit(L, (size_t)memlimit);
 		}
 
 		lua::initlibs(L, optparam(1, 0xCD), optparam(2, 0x1C00));
@@ -82,6 +64,132 @@ static cell AMX_NATIVE_CALL n_lua_close(AMX *amx, cell *params)
 	return 1;
 }
 
+// native lua_memusage(Lua:L, &peak=0, &limit=0);
+static cell AMX_NATIVE_CALL n_lua_memusage(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 1)) return 0;
+	auto L = reinterpret_cast<lua_State*>(params[1]);
+
+	size_t current, peak, limit;
+	if(!lua::getmemusage(L, current, peak, limit))
+	{
+		current = (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+		peak = limit = -1;
+	}
+
+	cell *addr;
+	if(params[0] >= 2 * sizeof(cell) && amx_GetAddr(amx, params[2], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(peak);
+	}
+	if(params[0] >= 3 * sizeof(cell) && amx_GetAddr(amx, params[3], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(limit);
+	}
+	return static_cast<cell>(current);
+}
+
+// native bool:lua_poolstats(Lua:L, &hits, &misses, &large=0);
+static cell AMX_NATIVE_CALL n_lua_poolstats(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 3)) return 0;
+	auto L = reinterpret_cast<lua_State*>(params[1]);
+
+	size_t hits, misses, large;
+	if(!lua::getpoolstats(L, hits, misses, large))
+	{
+		return 0;
+	}
+
+	cell *addr;
+	amx_GetAddr(amx, params[2], &addr);
+	*addr = static_cast<cell>(hits);
+	amx_GetAddr(amx, params[3], &addr);
+	*addr = static_cast<cell>(misses);
+	if(params[0] >= 4 * sizeof(cell) && amx_GetAddr(amx, params[4], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(large);
+	}
+	return 1;
+}
+
+// native lua_timerbudget(maxhandlers, maxmicros=0);
+static cell AMX_NATIVE_CALL n_lua_timerbudget(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 1)) return 0;
+	lua::timer::setbudget(params[1] > 0 ? params[1] : 0, optparam(2, 0));
+	return 1;
+}
+
+// native lua_sharedinterop(bool:shared);
+static cell AMX_NATIVE_CALL n_lua_sharedinterop(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 1)) return 0;
+	bool old = lua::interop::router_shared();
+	lua::interop::router_setshared(params[1] != 0);
+	return old;
+}
+
+// native lua_cachedir(const dir[]);
+static cell AMX_NATIVE_CALL n_lua_cachedir(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 1)) return 0;
+	const char *dir;
+	amx_StrParam(amx, params[1], dir);
+	lua::compiler::setcachedir(dir);
+	return 1;
+}
+
+// native lua_cachestats(&hits, &misses, &entries=0);
+static cell AMX_NATIVE_CALL n_lua_cachestats(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 2)) return 0;
+
+	size_t hits, misses, entries;
+	lua::compiler::getcachestats(hits, misses, entries);
+
+	cell *addr;
+	amx_GetAddr(amx, params[1], &addr);
+	*addr = static_cast<cell>(hits);
+	amx_GetAddr(amx, params[2], &addr);
+	*addr = static_cast<cell>(misses);
+	if(params[0] >= 3 * sizeof(cell) && amx_GetAddr(amx, params[3], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(entries);
+	}
+	return 1;
+}
+
+// native lua_timerstats(&run, &deferred, &maxlate=0, &maxlateticks=0, bool:reset=false);
+static cell AMX_NATIVE_CALL n_lua_timerstats(AMX *amx, cell *params)
+{
+	if(!lua::check_params(amx, params, 2)) return 0;
+
+	size_t run, deferred;
+	long long maxlate;
+	int maxlateticks;
+	lua::timer::getstats(run, deferred, maxlate, maxlateticks);
+	if(optparam(5, 0))
+	{
+		lua::timer::resetstats();
+	}
+
+	cell *addr;
+	amx_GetAddr(amx, params[1], &addr);
+	*addr = static_cast<cell>(run);
+	amx_GetAddr(amx, params[2], &addr);
+	*addr = static_cast<cell>(deferred);
+	if(params[0] >= 3 * sizeof(cell) && amx_GetAddr(amx, params[3], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(maxlate);
+	}
+	if(params[0] >= 4 * sizeof(cell) && amx_GetAddr(amx, params[4], &addr) == AMX_ERR_NONE)
+	{
+		*addr = static_cast<cell>(maxlateticks);
+	}
+	return 1;
+}
+
 // native lua_status:lua_pcall(Lua:L, nargs, nresults, errfunc=0);
 static cell AMX_NATIVE_CALL n_lua_pcall(AMX *amx, cell *params)
 {
@@ -743,20 +851,6 @@ struct LoadF
 };
 
 
-static const char *getF(lua_State *L, void *ud, size_t *size)
-{
-	LoadF *lf = (LoadF *)ud;
-	if(lf->n > 0)
-	{
-		*size = lf->n;
-		lf->n = 0;
-	}else{
-		if(feof(lf->f)) return NULL;
-		*size = fread(lf->buff, 1, sizeof(lf->buff), lf->f);
-	}
-	return lf->buff;
-}
-
 static int errfile(lua_State *L, const char *what)
 {
 	const char *serr = strerror(errno);
@@ -821,7 +915,7 @@ static cell AMX_NATIVE_CALL n_lua_loadstream(AMX *amx, cell *params)
 	{
 		return 0;
 	}
-	int status, readstatus;
+	int readstatus;
 	int c;
 	int top = lua_gettop(L);
 	if(skipcomment(&lf, &c))
@@ -832,7 +926,13 @@ static cell AMX_NATIVE_CALL n_lua_loadstream(AMX *amx, cell *params)
 	{
 		lf.buff[lf.n++] = c;
 	}
-	status = lua_load(L, getF, &lf, chunkname, mode);
+	// the whole code is read first so that it can be found in the chunk cache
+	std::string code(lf.buff, lf.n);
+	size_t len;
+	while((len = fread(lf.buff, 1, sizeof(lf.buff), lf.f)) > 0)
+	{
+		code.append(lf.buff, len);
+	}
 	readstatus = ferror(lf.f);
 	fclose(lf.f);
 	if(readstatus)
@@ -840,58 +940,21 @@ static cell AMX_NATIVE_CALL n_lua_loadstream(AMX *amx, cell *params)
 		lua_settop(L, top);
 		return errfile(L, "read");
 	}
-	return status;
+	return lua::compiler::loadstring(L, code, chunkname, mode);
 }
 
 class lua_loader_info
 {
-	std::thread thread;
-	std::mutex mutex;
-	std::condition_variable cond;
-	bool done = false;
+	lua_State *L;
+	std::string chunkname;
+	const char *mode;
 
 	std::string buffer;
-	int signal = LUA_YIELD;
-
-	const char *read(lua_State *L, size_t *sz)
-	{
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			done = true;
-		}
-		cond.notify_all();
-		std::unique_lock<std::mutex> lock(mutex);
-		cond.wait(lock);
-		*sz = buffer.size();
-		return buffer.c_str();
-	}
-
-	static const char *reader(lua_State *L, void *ud, size_t *sz)
-	{
-		return reinterpret_cast<lua_loader_info*>(ud)->read(L, sz);
-	}
-
-	static void load(lua_State *L, lua_loader_info *info, const char *chunkname, const char *mode)
-	{
-		info->signal = lua_load(L, reader, info, chunkname, mode);
-		{
-			std::unique_lock<std::mutex> lock(info->mutex);
-			info->done = true;
-		}
-		info->cond.notify_all();
-	}
 
 public:
-	lua_loader_info(lua_State *L, const char *chunkname, const char *mode)
+	lua_loader_info(lua_State *L, const char *chunkname, const char *mode) : L(L), chunkname(chunkname), mode(mode)
 	{
-		thread = std::thread(load, L, this, chunkname, mode);
 
-		std::unique_lock<std::mutex> lock(mutex);
-		while(!done)
-		{
-			cond.wait(lock);
-		}
-		done = false;
 	}
 
 	int write(const cell *data, size_t size)
@@ -901,37 +964,36 @@ public:
 			int len;
 			amx_StrLen(data, &len);
 			size = len;
-			buffer.resize(size);
-			if(size > 0)
+			if(size == 0)
 			{
-				amx_GetString(&buffer[0], data, false, size + 1);
+				return finish();
 			}
+			size_t pos = buffer.size();
+			buffer.resize(pos + size + 1);
+			amx_GetString(&buffer[pos], data, false, size + 1);
+			buffer.pop_back();
+		}else if(size == 0)
+		{
+			return finish();
 		}else{
-			buffer.resize(size);
-			char *str = &buffer[0];
+			size_t pos = buffer.size();
+			buffer.resize(pos + size);
+			char *str = &buffer[pos];
 			while(size > 0)
 			{
 				*str++ = (unsigned char)(ucell)(*data++);
 				size--;
 			}
 		}
+		return LUA_YIELD;
+	}
 
-		cond.notify_all();
-		{
-			std::unique_lock<std::mutex> lock(mutex);
-			while(!done)
-			{
-				cond.wait(lock);
-			}
-			done = false;
-		}
-		int sig = signal;
-		if(sig != LUA_YIELD)
-		{
-			thread.join();
-			delete this;
-		}
-		return sig;
+	int finish()
+	{
+		// chunks are only collected, the whole code is compiled in one pass when the stream ends
+		int status = luaL_loadbufferx(L, buffer.data(), buffer.size(), chunkname.c_str(), mode);
+		delete this;
+		return status;
 	}
 };
 
@@ -1047,6 +1109,13 @@ static AMX_NATIVE_INFO native_list[] =
 
 	AMX_DECLARE_NATIVE(lua_newstate),
 	AMX_DECLARE_NATIVE(lua_close),
+	AMX_DECLARE_NATIVE(lua_memusage),
+	AMX_DECLARE_NATIVE(lua_poolstats),
+	AMX_DECLARE_NATIVE(lua_timerbudget),
+	AMX_DECLARE_NATIVE(lua_timerstats),
+	AMX_DECLARE_NATIVE(lua_sharedinterop),
+	AMX_DECLARE_NATIVE(lua_cachedir),
+	AMX_DECLARE_NATIVE(lua_cachestats),
 	AMX_DECLARE_NATIVE(lua_load),
 	AMX_DECLARE_NATIVE(lua_pcall),
 	AMX_DECLARE_NATIVE(lua_call),
@@ -0,0 +1,166 @@
+#ifndef SIZE_CLASS_POOL_H_INCLUDED
+#define SIZE_CLASS_POOL_H_INCLUDED
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace aux
+{
+	template <size_t Granularity, size_t MaxSize, size_t PageSize>
+	class size_class_pool
+	{
+		static_assert(Granularity >= sizeof(void*) && Granularity % sizeof(void*) == 0, "invalid granularity");
+		static_assert(MaxSize % Granularity == 0 && PageSize >= MaxSize, "invalid size limits");
+
+		static constexpr size_t num_classes = MaxSize / Granularity;
+
+		struct free_block
+		{
+			free_block *next;
+		};
+
+		free_block *freelists[num_classes] = {};
+		std::vector<void*> pages;
+		unsigned char *page_pos = nullptr;
+		size_t page_left = 0;
+
+		static size_t class_index(size_t size)
+		{
+			return (size + Granularity - 1) / Granularity - 1;
+		}
+
+		void push_free(void *ptr, size_t index)
+		{
+			auto block = reinterpret_cast<free_block*>(ptr);
+			block->next = freelists[index];
+			freelists[index] = block;
+		}
+
+		void *carve(size_t index)
+		{
+			size_t size = (index + 1) * Granularity;
+			if(page_left < size)
+			{
+				if(page_left > 0)
+				{
+					push_free(page_pos, class_index(page_left));
+				}
+				auto page = reinterpret_cast<unsigned char*>(std::malloc(PageSize));
+				if(!page)
+				{
+					page_left = 0;
+					return nullptr;
+				}
+				pages.push_back(page);
+				page_pos = page;
+				page_left = PageSize;
+			}
+			void *ptr = page_pos;
+			page_pos += size;
+			page_left -= size;
+			return ptr;
+		}
+
+	public:
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t large = 0;
+
+		size_class_pool() = default;
+		size_class_pool(const size_class_pool &obj) = delete;
+		size_class_pool &operator=(const size_class_pool &obj) = delete;
+
+		~size_class_pool()
+		{
+			for(void *page : pages)
+			{
+				std::free(page);
+			}
+		}
+
+		void *allocate(size_t size)
+		{
+			if(size > MaxSize)
+			{
+				large++;
+				return std::malloc(size);
+			}
+			size_t index = class_index(size);
+			if(auto block = freelists[index])
+			{
+				hits++;
+				freelists[index] = block->next;
+				return block;
+			}
+			misses++;
+			return carve(index);
+		}
+
+		void deallocate(void *ptr, size_t size)
+		{
+			if(size > MaxSize)
+			{
+				std::free(ptr);
+			}else{
+				push_free(ptr, class_index(size));
+			}
+		}
+
+		void *reallocate(void *ptr, size_t osize, size_t nsize)
+		{
+			if(nsize == 0)
+			{
+				if(ptr)
+				{
+					deallocate(ptr, osize);
+				}
+				return nullptr;
+			}
+			if(!ptr)
+			{
+				return allocate(nsize);
+			}
+			if(osize > MaxSize && nsize > MaxSize)
+			{
+				return std::realloc(ptr, nsize);
+			}
+			if(osize <= MaxSize && nsize <= MaxSize && class_index(osize) == class_index(nsize))
+			{
+				return ptr;
+			}
+			void *ret = allocate(nsize);
+			if(!ret)
+			{
+				if(nsize >= osize)
+				{
+					return nullptr;
+				}
+				if(osize <= MaxSize)
+				{
+					// shrinking must not fail, the block of the larger class is still large enough
+					return ptr;
+				}
+				// a large block will be freed as a block of the small class, so it is kept by the pool like a page
+				ret = std::realloc(ptr, nsize);
+				if(!ret)
+				{
+					ret = ptr;
+				}
+				try{
+					pages.push_back(ret);
+				}catch(const std::bad_alloc&)
+				{
+
+				}
+				return ret;
+			}
+			std::memcpy(ret, ptr, osize < nsize ? osize : nsize);
+			deallocate(ptr, osize);
+			return ret;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef TIMER_QUEUE_H_INCLUDED
+#define TIMER_QUEUE_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+namespace aux
+{
+	typedef unsigned long long timer_id;
+
+	template <class Time, class Handler>
+	class timer_queue
+	{
+		struct slot
+		{
+			Handler handler;
+			unsigned int generation = 1;
+			bool active = false;
+			bool deferred = false;
+		};
+
+		struct entry
+		{
+			Time time;
+			unsigned long long order;
+			unsigned int index;
+			unsigned int generation;
+
+			// inverted so that the std heap functions keep the earliest entry on top
+			bool operator<(const entry &obj) const
+			{
+				if(obj.time < time) return true;
+				if(time < obj.time) return false;
+				return obj.order < order;
+			}
+		};
+
+		std::vector<slot> slots;
+		std::vector<unsigned int> free_slots;
+		std::vector<entry> heap;
+		unsigned long long order = 0;
+		size_t active = 0;
+
+		static timer_id make_id(unsigned int index, unsigned int generation)
+		{
+			return (static_cast<timer_id>(generation) << 32) | index;
+		}
+
+		slot *find(timer_id id, unsigned int &index)
+		{
+			index = static_cast<unsigned int>(id);
+			if(index >= slots.size()) return nullptr;
+			auto &s = slots[index];
+			if(!s.active || s.generation != static_cast<unsigned int>(id >> 32)) return nullptr;
+			return &s;
+		}
+
+		bool stale(const entry &e) const
+		{
+			auto &s = slots[e.index];
+			return !s.active || s.generation != e.generation;
+		}
+
+		void release(unsigned int index)
+		{
+			auto &s = slots[index];
+			s.handler = nullptr;
+			s.active = false;
+			s.generation++;
+			free_slots.push_back(index);
+			active--;
+		}
+
+		void compact()
+		{
+			if(active == 0)
+			{
+				heap.clear();
+			}else if(heap.size() > 64 && heap.size() > 2 * active)
+			{
+				heap.erase(std::remove_if(heap.begin(), heap.end(), [&](const entry &e) {return stale(e); }), heap.end());
+				std::make_heap(heap.begin(), heap.end());
+			}
+		}
+
+	public:
+		timer_id add(const Time &time, Handler &&handler)
+		{
+			unsigned int index;
+			if(free_slots.empty())
+			{
+				index = static_cast<unsigned int>(slots.size());
+				slots.emplace_back();
+			}else{
+				index = free_slots.back();
+				free_slots.pop_back();
+			}
+			auto &s = slots[index];
+			s.handler = std::move(handler);
+			s.active = true;
+			s.deferred = false;
+			active++;
+
+			heap.push_back(entry{time, order++, index, s.generation});
+			std::push_heap(heap.begin(), heap.end());
+			return make_id(index, s.generation);
+		}
+
+		bool cancel(timer_id id)
+		{
+			unsigned int index;
+			if(!find(id, index)) return false;
+			release(index);
+			compact();
+			return true;
+		}
+
+		bool pop(const Time &now, Handler &handler)
+		{
+			Time time;
+			return pop(now, handler, time);
+		}
+
+		bool pop(const Time &now, Handler &handler, Time &time)
+		{
+			while(!heap.empty())
+			{
+				auto &top = heap.front();
+				if(stale(top))
+				{
+					std::pop_heap(heap.begin(), heap.end());
+					heap.pop_back();
+					continue;
+				}
+				if(now < top.time)
+				{
+					return false;
+				}
+				unsigned int index = top.index;
+				time = top.time;
+				std::pop_heap(heap.begin(), heap.end());
+				heap.pop_back();
+				handler = std::move(slots[index].handler);
+				release(index);
+				return true;
+			}
+			return false;
+		}
+
+		bool next(Time &time)
+		{
+			while(!heap.empty())
+			{
+				auto &top = heap.front();
+				if(stale(top))
+				{
+					std::pop_heap(heap.begin(), heap.end());
+					heap.pop_back();
+					continue;
+				}
+				time = top.time;
+				return true;
+			}
+			return false;
+		}
+
+		// marks the entries that are due and returns how many of them were not marked before
+		size_t defer_due(const Time &now)
+		{
+			// entries below a pending one cannot be due, so only the due part of the heap is visited
+			size_t count = 0;
+			std::vector<size_t> pending;
+			if(!heap.empty())
+			{
+				pending.push_back(0);
+			}
+			while(!pending.empty())
+			{
+				size_t i = pending.back();
+				pending.pop_back();
+				auto &e = heap[i];
+				if(now < e.time)
+				{
+					continue;
+				}
+				if(!stale(e) && !slots[e.index].deferred)
+				{
+					slots[e.index].deferred = true;
+					count++;
+				}
+				for(size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap.size(); c++)
+				{
+					pending.push_back(c);
+				}
+			}
+			return count;
+		}
+
+		bool empty() const
+		{
+			return active == 0;
+		}
+
+		size_t size() const
+		{
+			return active;
+		}
+
+		void clear()
+		{
+			for(auto &s : slots)
+			{
+				if(s.active)
+				{
+					s.handler = nullptr;
+					s.active = false;
+				}
+				s.generation++;
+			}
+			free_slots.clear();
+			for(size_t i = slots.size(); i > 0; i--)
+			{
+				free_slots.push_back(static_cast<unsigned int>(i - 1));
+			}
+			heap.clear();
+			active = 0;
+		}
+	};
+}
+
+#endif